@@ -0,0 +1,352 @@
+// Guest workload benchmark harness. Every run of every workload happens in a forked child, so wall time
+// covers one vmRun from a freshly loaded image and the child's peak RSS is reported on its own.
+//
+//   gcc -O2 -pthread -o bench/bench bench/bench.c -ldl
+//   bench/bench [--engine switch|threaded|jit|aot|all] [--runs n] [--warmup n] [--json path]
+//               [--baseline path] [--tolerance percent] [workload.mi | directory] ...
+//
+// With no workloads given it runs every .mi file in bench/workloads. Results are printed as a table and,
+// with --json, written one workload per line so a later run can read them back as its --baseline; the
+// comparison flags workloads whose MIPS dropped by more than the tolerance and makes the exit status 2.
+#define RISKXVII_NO_MAIN
+#include "../vm_riskxvii.c"
+
+#include <sys/resource.h>
+
+#define MAX_RUNS 101
+#define MAX_WORKLOADS 256
+
+typedef struct // what a child sends back through its pipe
+{
+    int loaded;
+    VMStatus status;
+    uint64_t instructions;
+    double seconds;
+} RunResult;
+
+typedef struct
+{
+    char name[64];
+    VMEngine engine;
+    int failed;
+    VMStatus status;
+    uint64_t instructions;
+    double seconds[MAX_RUNS]; // sorted once every run is in
+    int runs;
+    long peakRssKb;
+} BenchResult;
+
+const char *engineNames[] = {"switch", "threaded", "jit", "aot"};
+
+double benchSecondsNow()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+RunResult runChild(const char *path, VMEngine engine)
+{
+    RunResult result = {0};
+    VM *vm = vmCreate();
+    if (vm == NULL || vmLoadFile(vm, path) != 0)
+    {
+        return result;
+    }
+    FILE *input = fopen("/dev/null", "r");
+    FILE *output = fopen("/dev/null", "w");
+    vmSetConsole(vm, input, output);
+    vmSetEngine(vm, engine);
+    if (engine == VM_ENGINE_AOT)
+    {
+        vmAotPrepare(vm); // compiling or loading the cached object is not part of the run
+    }
+    double start = benchSecondsNow();
+    result.status = vmRun(vm, VM_RUN_FOREVER);
+    vmFlushOutput(vm);
+    result.seconds = benchSecondsNow() - start;
+    result.instructions = vmInstructionsExecuted(vm);
+    result.loaded = 1;
+    vmDestroy(vm);
+    fclose(input);
+    fclose(output);
+    return result;
+}
+
+int runOnce(const char *path, VMEngine engine, RunResult *result, long *peakRssKb) // -1 when the child died
+{
+    int channel[2];
+    if (pipe(channel) != 0)
+    {
+        return -1;
+    }
+    fflush(NULL);
+    pid_t child = fork();
+    if (child == 0)
+    {
+        close(channel[0]);
+        RunResult run = runChild(path, engine);
+        ssize_t written = write(channel[1], &run, sizeof(run));
+        _exit(written == sizeof(run) ? 0 : 1);
+    }
+    close(channel[1]);
+    ssize_t got = child > 0 ? read(channel[0], result, sizeof(*result)) : -1;
+    close(channel[0]);
+    int status = 0;
+    struct rusage usage;
+    if (child < 0 || wait4(child, &status, 0, &usage) < 0 || got != sizeof(*result) || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        return -1;
+    }
+    if (usage.ru_maxrss > *peakRssKb)
+    {
+        *peakRssKb = usage.ru_maxrss;
+    }
+    return 0;
+}
+
+int compareDoubles(const void *a, const void *b)
+{
+    double left = *(const double *)a;
+    double right = *(const double *)b;
+    return (left > right) - (left < right);
+}
+
+double medianSeconds(const BenchResult *result)
+{
+    return result->seconds[result->runs / 2];
+}
+
+double resultMips(const BenchResult *result)
+{
+    double seconds = medianSeconds(result);
+    return seconds > 0 ? result->instructions / seconds / 1e6 : 0;
+}
+
+void benchmark(const char *path, VMEngine engine, int runs, int warmup, BenchResult *result)
+{
+    const char *name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+    snprintf(result->name, sizeof(result->name), "%.*s", (int)(strlen(name) > 3 ? strlen(name) - 3 : strlen(name)), name);
+    result->engine = engine;
+    for (int i = 0; i < warmup + runs; i++)
+    {
+        RunResult run;
+        if (runOnce(path, engine, &run, &result->peakRssKb) != 0 || !run.loaded)
+        {
+            result->failed = 1;
+            return;
+        }
+        if (i >= warmup)
+        {
+            result->seconds[result->runs++] = run.seconds;
+            result->instructions = run.instructions;
+            result->status = run.status;
+        }
+    }
+    qsort(result->seconds, result->runs, sizeof(double), compareDoubles);
+}
+
+int comparePaths(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+int collectWorkloads(const char *source, char **paths, int count)
+{
+    DIR *directory = opendir(source);
+    if (directory == NULL)
+    {
+        if (count < MAX_WORKLOADS)
+        {
+            paths[count++] = strdup(source);
+        }
+        return count;
+    }
+    int first = count;
+    struct dirent *entry;
+    while ((entry = readdir(directory)) != NULL && count < MAX_WORKLOADS)
+    {
+        size_t length = strlen(entry->d_name);
+        if (length > 3 && strcmp(entry->d_name + length - 3, ".mi") == 0)
+        {
+            size_t pathLength = strlen(source) + length + 2;
+            paths[count] = malloc(pathLength);
+            snprintf(paths[count++], pathLength, "%s/%s", source, entry->d_name);
+        }
+    }
+    closedir(directory);
+    qsort(paths + first, count - first, sizeof(char *), comparePaths);
+    return count;
+}
+
+int writeJson(const char *path, const BenchResult *results, int count)
+{
+    FILE *output = fopen(path, "w");
+    if (output == NULL)
+    {
+        return -1;
+    }
+    fprintf(output, "[\n");
+    for (int i = 0; i < count; i++)
+    {
+        const BenchResult *result = &results[i];
+        if (result->failed)
+        {
+            fprintf(output, "  {\"workload\": \"%s\", \"engine\": \"%s\", \"failed\": true}", result->name, engineNames[result->engine]);
+        }
+        else
+        {
+            fprintf(output, "  {\"workload\": \"%s\", \"engine\": \"%s\", \"status\": \"%s\", \"instructions\": %llu, \"runs\": %d, "
+                            "\"median_seconds\": %.6f, \"min_seconds\": %.6f, \"max_seconds\": %.6f, \"mips\": %.3f, \"peak_rss_kb\": %ld}",
+                    result->name, engineNames[result->engine], vmStatusName(result->status), (unsigned long long)result->instructions,
+                    result->runs, medianSeconds(result), result->seconds[0], result->seconds[result->runs - 1], resultMips(result),
+                    result->peakRssKb);
+        }
+        fprintf(output, "%s\n", i + 1 < count ? "," : "");
+    }
+    fprintf(output, "]\n");
+    return fclose(output);
+}
+
+int baselineMips(const char *path, const BenchResult *result, double *mips) // reads back a file written by writeJson, 0 when found
+{
+    FILE *input = fopen(path, "r");
+    if (input == NULL)
+    {
+        return -1;
+    }
+    char line[1024];
+    char workload[64];
+    char engine[16];
+    int found = -1;
+    while (found != 0 && fgets(line, sizeof(line), input) != NULL)
+    {
+        const char *field = strstr(line, "\"mips\": ");
+        if (sscanf(line, " {\"workload\": \"%63[^\"]\", \"engine\": \"%15[^\"]\"", workload, engine) == 2 && field != NULL &&
+            strcmp(workload, result->name) == 0 && strcmp(engine, engineNames[result->engine]) == 0)
+        {
+            *mips = strtod(field + 8, NULL);
+            found = 0;
+        }
+    }
+    fclose(input);
+    return found;
+}
+
+int main(int argc, char *argv[])
+{
+    int engines[4] = {1, 0, 0, 0};
+    int runs = 5;
+    int warmup = 1;
+    const char *jsonPath = NULL;
+    const char *baselinePath = NULL;
+    double tolerance = 5.0;
+    char *paths[MAX_WORKLOADS];
+    int workloadCount = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--engine") == 0 && i + 1 < argc)
+        {
+            const char *name = argv[++i];
+            memset(engines, 0, sizeof(engines));
+            for (int engine = 0; engine < 4; engine++)
+            {
+                engines[engine] = strcmp(name, "all") == 0 || strcmp(name, engineNames[engine]) == 0;
+            }
+        }
+        else if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc)
+        {
+            runs = atoi(argv[++i]);
+            runs = runs < 1 ? 1 : runs > MAX_RUNS ? MAX_RUNS : runs;
+        }
+        else if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc)
+        {
+            warmup = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc)
+        {
+            jsonPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc)
+        {
+            baselinePath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc)
+        {
+            tolerance = strtod(argv[++i], NULL);
+        }
+        else if (strncmp(argv[i], "--", 2) == 0)
+        {
+            printf("Unknown option: %s\n", argv[i]);
+            return 1;
+        }
+        else
+        {
+            workloadCount = collectWorkloads(argv[i], paths, workloadCount);
+        }
+    }
+    if (workloadCount == 0)
+    {
+        workloadCount = collectWorkloads("bench/workloads", paths, 0);
+    }
+    if (workloadCount == 0)
+    {
+        printf("No workloads found, run from the repository root or name .mi files\n");
+        return 1;
+    }
+
+    BenchResult *results = calloc(workloadCount * 4, sizeof(BenchResult));
+    int count = 0;
+    int regressions = 0;
+    printf("%-16s %-9s %-10s %14s %4s %10s %10s %10s %10s", "workload", "engine", "status", "instructions", "runs", "median ms", "min ms",
+           "MIPS", "RSS KiB");
+    printf(baselinePath ? " %10s %8s\n" : "\n", "base MIPS", "change");
+    for (int w = 0; w < workloadCount; w++)
+    {
+        for (int engine = 0; engine < 4; engine++)
+        {
+            if (!engines[engine])
+            {
+                continue;
+            }
+            BenchResult *result = &results[count++];
+            benchmark(paths[w], engine, runs, warmup, result);
+            if (result->failed)
+            {
+                printf("%-16s %-9s %-10s\n", result->name, engineNames[engine], "failed");
+                continue;
+            }
+            printf("%-16s %-9s %-10s %14llu %4d %10.3f %10.3f %10.2f %10ld", result->name, engineNames[engine], vmStatusName(result->status),
+                   (unsigned long long)result->instructions, result->runs, medianSeconds(result) * 1e3, result->seconds[0] * 1e3,
+                   resultMips(result), result->peakRssKb);
+            double base;
+            if (baselinePath != NULL && baselineMips(baselinePath, result, &base) == 0 && base > 0)
+            {
+                double change = (resultMips(result) - base) / base * 100;
+                int regressed = change < -tolerance;
+                regressions += regressed;
+                printf(" %10.2f %+7.1f%%%s", base, change, regressed ? "  REGRESSION" : "");
+            }
+            else if (baselinePath != NULL)
+            {
+                printf(" %10s %8s", "-", "new");
+            }
+            printf("\n");
+        }
+    }
+    if (jsonPath != NULL && writeJson(jsonPath, results, count) != 0)
+    {
+        perror("Unable to write results");
+        return 1;
+    }
+    if (baselinePath != NULL)
+    {
+        printf("%d regression%s beyond %.1f%%\n", regressions, regressions == 1 ? "" : "s", tolerance);
+    }
+    for (int w = 0; w < workloadCount; w++)
+    {
+        free(paths[w]);
+    }
+    free(results);
+    return regressions ? 2 : 0;
+}
@@ -0,0 +1,309 @@
+// Host-side microbenchmarks of the VM's components: instruction decode, dispatch through execute() and the
+// threaded engine, guest address translation for loads and stores, and the malloc/free, DMA and console block devices. Each
+// benchmark runs a few untimed warmup repetitions, then REPETITIONS timed ones; the report gives the median
+// and best ns/op, median cycles/op from the time-stamp counter (reference cycles, x86 only) and the spread.
+//
+//   gcc -O2 -pthread -o bench/microbench bench/microbench.c -ldl -lm
+//   bench/microbench [filter]   # only benchmarks whose name contains filter
+#define RISKXVII_NO_MAIN
+#include "../vm_riskxvii.c"
+
+#include <math.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define cycleCounter() __rdtsc()
+#define HAVE_CYCLES 1
+#else
+#define cycleCounter() 0
+#define HAVE_CYCLES 0
+#endif
+
+#define WARMUP 3
+#define REPETITIONS 21
+#define ADDRESS_COUNT 4096 // power of two
+#define DECODE_WORDS 512   // power of two, the halfword slots of the default instruction memory
+
+typedef struct
+{
+    VM *vm;
+    unsigned int raw[DECODE_WORDS]; // instruction words of a mixed image for the decoder
+    unsigned int addresses[ADDRESS_COUNT];
+    unsigned int live[32]; // allocations kept around by the fragmented malloc benchmark
+    volatile uint64_t sink; // results go here so the compiler keeps the work
+} Fixture;
+
+typedef void (*BenchBody)(Fixture *fixture, uint64_t ops);
+
+unsigned int encodeR(unsigned int func7, int rs2, int rs1, unsigned int func3, int rd)
+{
+    return func7 << 25 | rs2 << 20 | rs1 << 15 | func3 << 12 | rd << 7 | 0x33;
+}
+
+unsigned int encodeI(unsigned int opcode, int imm, int rs1, unsigned int func3, int rd)
+{
+    return ((unsigned int)imm & 0xfff) << 20 | rs1 << 15 | func3 << 12 | rd << 7 | opcode;
+}
+
+unsigned int encodeJal(int rd, int offset)
+{
+    unsigned int o = (unsigned int)offset & 0x1fffff;
+    return ((o >> 20) & 1) << 31 | ((o >> 1) & 0x3ff) << 21 | ((o >> 11) & 1) << 20 | ((o >> 12) & 0xff) << 12 | rd << 7 | 0x6f;
+}
+
+uint32_t nextRandom(uint32_t *state) // xorshift32
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+void benchDecode(Fixture *fixture, uint64_t ops)
+{
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < ops; i++)
+    {
+        DecodedOp op = decodeInstruction(fixture->raw[i & (DECODE_WORDS - 1)]);
+        sum += op.handler + op.imm;
+    }
+    fixture->sink = sum;
+}
+
+void benchPredecode(Fixture *fixture, uint64_t ops) // one op is a whole image: decode, branch check and fusion
+{
+    for (uint64_t i = 0; i < ops; i++)
+    {
+        predecode(fixture->vm);
+    }
+    fixture->sink = fixture->vm->decodedOps[0].handler;
+}
+
+void loadLoop(Fixture *fixture) // addi, add, xor and a jal back to the start: pure dispatch, no memory
+{
+    unsigned char image[VM_IMAGE_SIZE] = {0};
+    unsigned int words[] = {encodeI(0x13, 1, 5, 0, 5), encodeR(0, 5, 6, 0, 6), encodeR(0, 6, 7, 4, 7), encodeJal(0, -12)};
+    for (size_t i = 0; i < sizeof(words) / sizeof(words[0]); i++)
+    {
+        store32(image + i * 4, words[i]);
+    }
+    vmLoadImage(fixture->vm, image, sizeof(image));
+}
+
+void benchExecute(Fixture *fixture, uint64_t ops)
+{
+    VM *vm = fixture->vm;
+    for (uint64_t i = 0; i < ops; i++)
+    {
+        execute(vm, &vm->decodedOps[vm->pc >> 1]);
+    }
+    fixture->sink = vm->regs[7];
+}
+
+void benchThreaded(Fixture *fixture, uint64_t ops)
+{
+    runThreaded(fixture->vm, ops);
+    fixture->sink = fixture->vm->regs[7];
+}
+
+void benchLoadHeap(Fixture *fixture, uint64_t ops) // loadAddress as lw does it, heap addresses in random order
+{
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < ops; i++)
+    {
+        unsigned char *source = loadAddress(fixture->vm, fixture->addresses[i & (ADDRESS_COUNT - 1)], 4);
+        sum += load32(source);
+    }
+    fixture->sink = sum;
+}
+
+void benchStoreHeap(Fixture *fixture, uint64_t ops)
+{
+    for (uint64_t i = 0; i < ops; i++)
+    {
+        unsigned char *target = storeAddress(fixture->vm, fixture->addresses[i & (ADDRESS_COUNT - 1)], 4);
+        store32(target, (uint32_t)i);
+    }
+    fixture->sink = fixture->vm->heapMemory[0];
+}
+
+void benchLoadData(Fixture *fixture, uint64_t ops) // data memory pages, which go through the same table
+{
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < ops; i++)
+    {
+        unsigned int address = fixture->vm->instSize + (fixture->addresses[i & (ADDRESS_COUNT - 1)] & (fixture->vm->dataSize - 4));
+        sum += load32(loadAddress(fixture->vm, address, 4));
+    }
+    fixture->sink = sum;
+}
+
+void benchMallocFree(Fixture *fixture, uint64_t ops) // one op is a malloc and its free through the device handlers
+{
+    VM *vm = fixture->vm;
+    for (uint64_t i = 0; i < ops; i++)
+    {
+        virtualWriteCheck(vm, 2096, 1 + (i & 255));
+        virtualWriteCheck(vm, 2100, vm->regs[28]);
+    }
+    fixture->sink = vm->regs[28];
+}
+
+void benchMallocFragmented(Fixture *fixture, uint64_t ops) // 32 live blocks of mixed sizes, the oldest replaced each op
+{
+    VM *vm = fixture->vm;
+    uint32_t state = 12345;
+    for (uint64_t i = 0; i < ops; i++)
+    {
+        unsigned int *slot = &fixture->live[i & 31];
+        virtualWriteCheck(vm, 2100, *slot);
+        virtualWriteCheck(vm, 2096, 1 + (nextRandom(&state) & 255));
+        *slot = vm->regs[28];
+    }
+    fixture->sink = vm->regs[28];
+}
+
+void benchDmaCopy(Fixture *fixture, uint64_t ops) // one op is a 256-byte heap to heap copy, registers and command
+{
+    VM *vm = fixture->vm;
+    for (uint64_t i = 0; i < ops; i++)
+    {
+        virtualWriteCheck(vm, 2112, vm->heapStart + (i & 7) * 256);
+        virtualWriteCheck(vm, 2116, vm->heapStart + 4096 + (i & 7) * 256);
+        virtualWriteCheck(vm, 2120, 256);
+        virtualWriteCheck(vm, 2124, DMA_COPY);
+    }
+    fixture->sink = vm->heapMemory[4096];
+}
+
+void benchConsoleBlock(Fixture *fixture, uint64_t ops) // one op is a 64-byte heap range written to the (null) console
+{
+    VM *vm = fixture->vm;
+    for (uint64_t i = 0; i < ops; i++)
+    {
+        virtualWriteCheck(vm, 2128, vm->heapStart + (i & 63) * 64);
+        virtualWriteCheck(vm, 2132, 64);
+    }
+    vmFlushOutput(vm);
+    fixture->sink = vm->outputLength;
+}
+
+typedef struct
+{
+    const char *name;
+    BenchBody body;
+    uint64_t ops; // per repetition
+    void (*setup)(Fixture *fixture);
+} Microbenchmark;
+
+void resetHeap(Fixture *fixture)
+{
+    unsigned char image[VM_IMAGE_SIZE] = {0};
+    vmLoadImage(fixture->vm, image, sizeof(image)); // loading resets the heap
+    memset(fixture->live, 0, sizeof(fixture->live));
+}
+
+const Microbenchmark benchmarks[] = {
+    {"decode", benchDecode, 1 << 20, NULL},
+    {"predecode image", benchPredecode, 1 << 10, NULL},
+    {"execute dispatch", benchExecute, 1 << 22, loadLoop},
+    {"threaded dispatch", benchThreaded, 1 << 22, loadLoop},
+    {"heap load address", benchLoadHeap, 1 << 22, resetHeap},
+    {"heap store address", benchStoreHeap, 1 << 22, resetHeap},
+    {"data load address", benchLoadData, 1 << 22, resetHeap},
+    {"malloc+free", benchMallocFree, 1 << 18, resetHeap},
+    {"malloc fragmented", benchMallocFragmented, 1 << 18, resetHeap},
+    {"dma copy 256", benchDmaCopy, 1 << 20, resetHeap},
+    {"console block 64", benchConsoleBlock, 1 << 20, resetHeap}};
+
+int compareDoubles(const void *a, const void *b)
+{
+    double left = *(const double *)a;
+    double right = *(const double *)b;
+    return (left > right) - (left < right);
+}
+
+void measure(Fixture *fixture, const Microbenchmark *benchmark)
+{
+    double nanoseconds[REPETITIONS];
+    double cycles[REPETITIONS];
+    if (benchmark->setup != NULL)
+    {
+        benchmark->setup(fixture);
+    }
+    for (int i = 0; i < WARMUP; i++)
+    {
+        benchmark->body(fixture, benchmark->ops);
+    }
+    for (int i = 0; i < REPETITIONS; i++)
+    {
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        uint64_t startCycles = cycleCounter();
+        benchmark->body(fixture, benchmark->ops);
+        uint64_t endCycles = cycleCounter();
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        nanoseconds[i] = ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / benchmark->ops;
+        cycles[i] = (double)(endCycles - startCycles) / benchmark->ops;
+    }
+    double mean = 0;
+    for (int i = 0; i < REPETITIONS; i++)
+    {
+        mean += nanoseconds[i] / REPETITIONS;
+    }
+    double variance = 0;
+    for (int i = 0; i < REPETITIONS; i++)
+    {
+        variance += (nanoseconds[i] - mean) * (nanoseconds[i] - mean) / (REPETITIONS - 1);
+    }
+    qsort(nanoseconds, REPETITIONS, sizeof(double), compareDoubles);
+    qsort(cycles, REPETITIONS, sizeof(double), compareDoubles);
+    printf("%-20s %10llu %10.3f %10.3f ", benchmark->name, (unsigned long long)benchmark->ops, nanoseconds[REPETITIONS / 2], nanoseconds[0]);
+    if (HAVE_CYCLES)
+    {
+        printf("%10.2f", cycles[REPETITIONS / 2]);
+    }
+    else
+    {
+        printf("%10s", "-");
+    }
+    printf(" %7.1f%%\n", mean > 0 ? 100 * sqrt(variance) / mean : 0.0);
+}
+
+int main(int argc, char *argv[])
+{
+    Fixture fixture = {0};
+    fixture.vm = vmCreate();
+    if (fixture.vm == NULL)
+    {
+        printf("Error: unable to allocate memory.\n");
+        return 1;
+    }
+    FILE *devNull = fopen("/dev/null", "w");
+    vmSetConsole(fixture.vm, stdin, devNull);
+    uint32_t state = 2463534242u;
+    for (int i = 0; i < DECODE_WORDS; i++) // every instruction class the decoder knows, random operands
+    {
+        static const unsigned int opcodes[] = {0x33, 0x13, 0x03, 0x23, 0x63, 0x37, 0x6f, 0x67};
+        fixture.raw[i] = (nextRandom(&state) & ~0x7fu) | opcodes[i & 7];
+    }
+    for (int i = 0; i < ADDRESS_COUNT; i++)
+    {
+        fixture.addresses[i] = fixture.vm->heapStart + (nextRandom(&state) % (fixture.vm->heapEnd - fixture.vm->heapStart - 3));
+    }
+    if (!HAVE_CYCLES)
+    {
+        printf("no cycle counter on this host, cycles/op not reported\n");
+    }
+    printf("%-20s %10s %10s %10s %10s %8s\n", "benchmark", "ops/rep", "median ns", "best ns", "cycles/op", "stddev");
+    for (size_t i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i++)
+    {
+        if (argc < 2 || strstr(benchmarks[i].name, argv[1]) != NULL)
+        {
+            measure(&fixture, &benchmarks[i]);
+        }
+    }
+    vmDestroy(fixture.vm);
+    fclose(devNull);
+    return 0;
+}
@@ -0,0 +1,181 @@
+#!/usr/bin/env python3
+"""Minimal RISK-XVII assembler for the benchmark workloads.
+
+usage: rxasm.py source.s image.mi
+
+One instruction per line, '#' comments, 'label:' prefixes, x0-x31 or ABI
+register names, and the 'li rd, value' pseudo-instruction (always lui+addi).
+RVC instructions are written with their 'c.' mnemonics and take 2 bytes.
+Branch and jal operands may be labels. The output is a 2048-byte image:
+instruction memory followed by zeroed data memory.
+"""
+import re
+import struct
+import sys
+
+REGISTERS = {f'x{i}': i for i in range(32)}
+REGISTERS.update(zero=0, ra=1, sp=2, gp=3, tp=4, t0=5, t1=6, t2=7, s0=8, fp=8, s1=9,
+                 a0=10, a1=11, a2=12, a3=13, a4=14, a5=15, a6=16, a7=17,
+                 s2=18, s3=19, s4=20, s5=21, s6=22, s7=23, s8=24, s9=25, s10=26, s11=27,
+                 t3=28, t4=29, t5=30, t6=31)
+R_TYPE = {'add': (0, 0), 'sub': (0, 32), 'sll': (1, 0), 'slt': (2, 0), 'sltu': (3, 0), 'xor': (4, 0),
+          'srl': (5, 0), 'sra': (5, 32), 'or': (6, 0), 'and': (7, 0),
+          'mul': (0, 1), 'mulh': (1, 1), 'mulhsu': (2, 1), 'mulhu': (3, 1), 'div': (4, 1), 'divu': (5, 1), 'rem': (6, 1), 'remu': (7, 1)}
+I_TYPE = {'addi': 0, 'slti': 2, 'sltiu': 3, 'xori': 4, 'ori': 6, 'andi': 7}
+LOADS = {'lb': 0, 'lh': 1, 'lw': 2, 'lbu': 4, 'lhu': 5}
+STORES = {'sb': 0, 'sh': 1, 'sw': 2}
+BRANCHES = {'beq': 0, 'bne': 1, 'blt': 4, 'bge': 5, 'bltu': 6, 'bgeu': 7}
+C_ARITHMETIC = {'c.sub': 0, 'c.xor': 1, 'c.or': 2, 'c.and': 3}
+C_JUMPS = {'c.j', 'c.jal', 'c.beqz', 'c.bnez'}
+IMAGE_SIZE = 2048
+INST_MEM_SIZE = 1024
+
+
+def register(name):
+    return REGISTERS[name.strip()]
+
+
+def memory_operand(text):  # "imm(reg)"
+    match = re.fullmatch(r'\s*(-?\w*)\((\w+)\)\s*', text)
+    return int(match.group(1) or '0', 0), register(match.group(2))
+
+
+def prime(name):  # x8-x15, the registers 3-bit RVC fields can name
+    number = register(name) - 8
+    if not 0 <= number < 8:
+        raise SystemExit(f'{name} is not one of x8-x15')
+    return number
+
+
+def bits(value, high, low, to):  # value[high:low] placed at bit to
+    return ((value >> low) & ((1 << (high - low + 1)) - 1)) << to
+
+
+def compressed(op, args, offset):  # 16-bit encoding, offset is the resolved jump or branch target
+    if op == 'c.nop':
+        return 0x0001
+    if op in ('c.addi', 'c.li', 'c.lui'):
+        imm = int(args[1], 0)
+        func3 = {'c.addi': 0, 'c.li': 2, 'c.lui': 3}[op]
+        return func3 << 13 | bits(imm, 5, 5, 12) | register(args[0]) << 7 | bits(imm, 4, 0, 2) | 0b01
+    if op == 'c.addi16sp':
+        imm = int(args[0], 0)
+        return 3 << 13 | bits(imm, 9, 9, 12) | 2 << 7 | bits(imm, 4, 4, 6) | bits(imm, 6, 6, 5) | bits(imm, 8, 7, 3) \
+            | bits(imm, 5, 5, 2) | 0b01
+    if op == 'c.addi4spn':
+        imm = int(args[1], 0)
+        return bits(imm, 5, 4, 11) | bits(imm, 9, 6, 7) | bits(imm, 2, 2, 6) | bits(imm, 3, 3, 5) | prime(args[0]) << 2
+    if op in ('c.lw', 'c.sw'):
+        imm, base = memory_operand(args[1])
+        return (2 if op == 'c.lw' else 6) << 13 | bits(imm, 5, 3, 10) | (base - 8) << 7 | bits(imm, 2, 2, 6) \
+            | bits(imm, 6, 6, 5) | prime(args[0]) << 2
+    if op in ('c.jal', 'c.j'):
+        return (1 if op == 'c.jal' else 5) << 13 | bits(offset, 11, 11, 12) | bits(offset, 4, 4, 11) | bits(offset, 9, 8, 9) \
+            | bits(offset, 10, 10, 8) | bits(offset, 6, 6, 7) | bits(offset, 7, 7, 6) | bits(offset, 3, 1, 3) \
+            | bits(offset, 5, 5, 2) | 0b01
+    if op in ('c.beqz', 'c.bnez'):
+        return (6 if op == 'c.beqz' else 7) << 13 | bits(offset, 8, 8, 12) | bits(offset, 4, 3, 10) | prime(args[0]) << 7 \
+            | bits(offset, 7, 6, 5) | bits(offset, 2, 1, 3) | bits(offset, 5, 5, 2) | 0b01
+    if op == 'c.andi':
+        imm = int(args[1], 0)
+        return 4 << 13 | bits(imm, 5, 5, 12) | 2 << 10 | prime(args[0]) << 7 | bits(imm, 4, 0, 2) | 0b01
+    if op in C_ARITHMETIC:
+        return 4 << 13 | 3 << 10 | prime(args[0]) << 7 | C_ARITHMETIC[op] << 5 | prime(args[1]) << 2 | 0b01
+    if op == 'c.lwsp':
+        imm, _ = memory_operand(args[1])
+        return 2 << 13 | bits(imm, 5, 5, 12) | register(args[0]) << 7 | bits(imm, 4, 2, 4) | bits(imm, 7, 6, 2) | 0b10
+    if op == 'c.swsp':
+        imm, _ = memory_operand(args[1])
+        return 6 << 13 | bits(imm, 5, 2, 9) | bits(imm, 7, 6, 7) | register(args[0]) << 2 | 0b10
+    if op in ('c.jr', 'c.jalr'):
+        return 4 << 13 | (op == 'c.jalr') << 12 | register(args[0]) << 7 | 0b10
+    if op in ('c.mv', 'c.add'):
+        return 4 << 13 | (op == 'c.add') << 12 | register(args[0]) << 7 | register(args[1]) << 2 | 0b10
+    return None
+
+
+def assemble(source):
+    lines = []
+    labels = {}
+    pc = 0
+    for line in source.splitlines():
+        line = line.split('#')[0].strip()
+        while ':' in line:
+            label, line = line.split(':', 1)
+            labels[label.strip()] = pc
+            line = line.strip()
+        if line:
+            lines.append((pc, line))
+            op = line.split()[0]
+            pc += 8 if op == 'li' else 2 if op.startswith('c.') or op == '.half' else 4
+
+    def target(text, pc):
+        text = text.strip()
+        return labels[text] - pc if text in labels else int(text, 0)
+
+    code = bytearray()
+    for pc, line in lines:
+        parts = line.split(None, 1)
+        op = parts[0]
+        args = [a.strip() for a in parts[1].split(',')] if len(parts) > 1 else []
+        if op.startswith('c.') or op == '.half':
+            half = int(args[0], 0) if op == '.half' else compressed(op, args, target(args[-1], pc) if op in C_JUMPS else 0)
+            if half is None:
+                raise SystemExit(f'unknown instruction at pc {pc}: {line}')
+            code += struct.pack('<H', half & 0xffff)
+            continue
+        if op in R_TYPE:
+            func3, func7 = R_TYPE[op]
+            word = func7 << 25 | register(args[2]) << 20 | register(args[1]) << 15 | func3 << 12 | register(args[0]) << 7 | 0x33
+        elif op in I_TYPE:
+            word = (int(args[2], 0) & 0xfff) << 20 | register(args[1]) << 15 | I_TYPE[op] << 12 | register(args[0]) << 7 | 0x13
+        elif op in LOADS:
+            offset, base = memory_operand(args[1])
+            word = (offset & 0xfff) << 20 | base << 15 | LOADS[op] << 12 | register(args[0]) << 7 | 0x03
+        elif op in STORES:
+            offset, base = memory_operand(args[1])
+            offset &= 0xfff
+            word = (offset >> 5) << 25 | register(args[0]) << 20 | base << 15 | STORES[op] << 12 | (offset & 31) << 7 | 0x23
+        elif op in BRANCHES:
+            offset = target(args[2], pc) & 0x1fff
+            word = ((offset >> 12) & 1) << 31 | ((offset >> 5) & 0x3f) << 25 | register(args[1]) << 20 | register(args[0]) << 15 \
+                | BRANCHES[op] << 12 | ((offset >> 1) & 0xf) << 8 | ((offset >> 11) & 1) << 7 | 0x63
+        elif op == 'lui':
+            word = (int(args[1], 0) & 0xfffff) << 12 | register(args[0]) << 7 | 0x37
+        elif op == 'jal':
+            offset = target(args[1], pc) & 0x1fffff
+            word = ((offset >> 20) & 1) << 31 | ((offset >> 1) & 0x3ff) << 21 | ((offset >> 11) & 1) << 20 \
+                | ((offset >> 12) & 0xff) << 12 | register(args[0]) << 7 | 0x6f
+        elif op == 'jalr':
+            offset, base = memory_operand(args[1])
+            word = (offset & 0xfff) << 20 | base << 15 | register(args[0]) << 7 | 0x67
+        elif op == 'li':
+            value = int(args[1], 0) & 0xffffffff
+            low = value & 0xfff
+            if low & 0x800:
+                low -= 0x1000
+            code += struct.pack('<I', ((value - low) >> 12 & 0xfffff) << 12 | register(args[0]) << 7 | 0x37)
+            word = (low & 0xfff) << 20 | register(args[0]) << 15 | register(args[0]) << 7 | 0x13
+        elif op == '.word':
+            word = int(args[0], 0)
+        else:
+            raise SystemExit(f'unknown instruction at pc {pc}: {line}')
+        code += struct.pack('<I', word & 0xffffffff)
+    if len(code) > INST_MEM_SIZE:
+        raise SystemExit('program does not fit in instruction memory')
+    return code
+
+
+def main():
+    if len(sys.argv) != 3:
+        raise SystemExit(__doc__)
+    with open(sys.argv[1]) as source:
+        code = assemble(source.read())
+    image = bytearray(IMAGE_SIZE)
+    image[:len(code)] = code
+    with open(sys.argv[2], 'wb') as output:
+        output.write(image)
+
+
+if __name__ == '__main__':
+    main()
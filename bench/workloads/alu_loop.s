@@ -0,0 +1,22 @@
+# Tight ALU loop: seven register-only instructions and a backward branch per
+# iteration, no memory traffic. Prints a checksum and halts.
+        li      t6, 2048            # device page
+        li      s1, 4000000         # iterations
+        li      s0, 0
+        li      s2, 0x12345678
+        li      s3, 0
+        li      s4, 0
+        addi    t2, zero, 3
+loop:
+        add     s3, s3, s2
+        xor     s2, s2, s3
+        sll     t1, s2, t2
+        or      s4, s4, t1
+        sub     s3, s3, s4
+        andi    s4, s4, 1023
+        addi    s0, s0, 1
+        bne     s0, s1, loop
+        sw      s3, 4(t6)           # print the checksum
+        addi    t0, zero, 10
+        sb      t0, 0(t6)
+        sw      zero, 12(t6)        # halt
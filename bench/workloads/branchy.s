@@ -0,0 +1,31 @@
+# Branch-heavy: Collatz sequences for every n below 30000, each step takes a
+# data-dependent branch on the parity of the current value. Prints the total
+# number of steps.
+        li      t6, 2048
+        li      s0, 1               # n
+        li      s1, 30000
+        li      s2, 0               # steps
+        addi    t2, zero, 1
+        addi    t3, zero, 1
+outer:
+        addi    a0, s0, 0
+inner:
+        beq     a0, t3, done
+        andi    t1, a0, 1
+        beq     t1, zero, even
+        add     t0, a0, a0
+        add     a0, t0, a0
+        addi    a0, a0, 1           # 3n + 1, never above 2^31 for these n
+        jal     zero, next
+even:
+        srl     a0, a0, t2          # a0 is positive, logical and arithmetic shifts agree
+next:
+        addi    s2, s2, 1
+        jal     zero, inner
+done:
+        addi    s0, s0, 1
+        bne     s0, s1, outer
+        sw      s2, 4(t6)
+        addi    t0, zero, 10
+        sb      t0, 0(t6)
+        sw      zero, 12(t6)
@@ -0,0 +1,15 @@
+# Console-bound: prints 200000 lines of "<decimal> <hex>\n", most of the time
+# goes to the output devices rather than the instructions around them.
+        li      t6, 2048
+        li      s0, 0
+        li      s1, 200000
+        addi    s2, zero, 10        # newline
+        addi    s3, zero, 32        # space
+loop:
+        sw      s0, 4(t6)           # decimal
+        sb      s3, 0(t6)
+        sw      s0, 8(t6)           # hex
+        sb      s2, 0(t6)
+        addi    s0, s0, 1
+        bne     s0, s1, loop
+        sw      zero, 12(t6)
@@ -0,0 +1,41 @@
+# Memory-bound pointer chase: mallocs the whole heap, threads a circular list
+# of 512 16-byte nodes through it in a scattered order, then walks the list
+# with three loads and a store per node.
+        li      t6, 2048
+        li      a0, 8192
+        sw      a0, 48(t6)          # malloc(8192), the pointer comes back in t3
+        addi    s0, t3, 0           # base
+        li      s1, 512             # nodes
+        li      s2, 0               # node index
+        li      s3, 0               # slot of the current node
+        addi    t2, zero, 4         # slot to byte offset shift
+build:
+        addi    s4, s3, 37
+        andi    s4, s4, 511         # slot of the next node, 37 is odd so the list visits every slot
+        sll     t0, s3, t2
+        add     t0, t0, s0
+        sll     t1, s4, t2
+        add     t1, t1, s0
+        sw      t1, 0(t0)           # next
+        sw      s2, 4(t0)           # value
+        sw      zero, 8(t0)
+        addi    s3, s4, 0
+        addi    s2, s2, 1
+        bne     s2, s1, build
+        addi    a1, s0, 0           # p
+        li      a2, 0               # sum
+        li      a3, 3000000         # steps
+walk:
+        lw      t0, 4(a1)
+        add     a2, a2, t0
+        lw      t1, 8(a1)
+        add     a2, a2, t1
+        sh      a2, 12(a1)
+        lw      a1, 0(a1)
+        addi    a3, a3, -1
+        bne     a3, zero, walk
+        sw      a2, 4(t6)
+        addi    t0, zero, 10
+        sb      t0, 0(t6)
+        sw      s0, 52(t6)          # free
+        sw      zero, 12(t6)
@@ -0,0 +1,50 @@
+# Allocator churn: four live blocks, each freed and reallocated with a new
+# size between 16 and 512 bytes every iteration, and touched once.
+        li      t6, 2048
+        li      a1, 0x61c88647      # Weyl sequence step for the sizes
+        li      a0, 0
+        li      a3, 0               # checksum of the returned pointers
+        li      s5, 200000          # iterations
+        li      s1, 0
+        li      s2, 0
+        li      s3, 0
+        li      s4, 0
+loop:
+        sw      s1, 52(t6)          # free(s1), free(0) is ignored
+        add     a0, a0, a1
+        andi    a2, a0, 496
+        addi    a2, a2, 16
+        sw      a2, 48(t6)          # malloc
+        addi    s1, t3, 0
+        sw      a0, 0(s1)
+        add     a3, a3, t3
+        sw      s2, 52(t6)
+        add     a0, a0, a1
+        andi    a2, a0, 496
+        addi    a2, a2, 16
+        sw      a2, 48(t6)
+        addi    s2, t3, 0
+        sw      a0, 0(s2)
+        add     a3, a3, t3
+        sw      s3, 52(t6)
+        add     a0, a0, a1
+        andi    a2, a0, 496
+        addi    a2, a2, 16
+        sw      a2, 48(t6)
+        addi    s3, t3, 0
+        sw      a0, 0(s3)
+        add     a3, a3, t3
+        sw      s4, 52(t6)
+        add     a0, a0, a1
+        andi    a2, a0, 496
+        addi    a2, a2, 16
+        sw      a2, 48(t6)
+        addi    s4, t3, 0
+        sw      a0, 0(s4)
+        add     a3, a3, t3
+        addi    s5, s5, -1
+        bne     s5, zero, loop
+        sw      a3, 4(t6)
+        addi    t0, zero, 10
+        sb      t0, 0(t6)
+        sw      zero, 12(t6)
@@ -0,0 +1,161 @@
+# Little-endian loads and stores: lb/lbu/lh/lhu sign and zero extension, sb/sh/sw byte order, unaligned
+# words and halves, and accesses that straddle a 256-byte page inside data memory and inside the heap.
+# Results are collected in a heap buffer with no device access in between, so the JIT and AOT engines run
+# the code under test in compiled form, then printed in hex one per line. The .out file next to this one
+# holds the output every engine has to produce.
+        li      t6, 2048
+        addi    s11, zero, 10       # newline
+        addi    a0, zero, 1024
+        sw      a0, 48(t6)          # malloc the result buffer, the first block starts the heap at 0xb700
+        addi    s10, t3, 0
+        li      s0, 0x500        # data memory
+        li      s1, 0x600        # page boundary in data memory
+        # data memory
+        li      a0, 0x80ff7f01
+        sw      a0, 0(s0)
+        li      a0, 0x12345678
+        sw      a0, 4(s0)
+        lb      a1, 0(s0)
+        sw      a1, 0(s10)
+        lbu     a1, 0(s0)
+        sw      a1, 4(s10)
+        lb      a1, 1(s0)
+        sw      a1, 8(s10)
+        lbu     a1, 1(s0)
+        sw      a1, 12(s10)
+        lb      a1, 3(s0)
+        sw      a1, 16(s10)
+        lbu     a1, 3(s0)
+        sw      a1, 20(s10)
+        lh      a1, 0(s0)
+        sw      a1, 24(s10)
+        lhu     a1, 0(s0)
+        sw      a1, 28(s10)
+        lh      a1, 2(s0)
+        sw      a1, 32(s10)
+        lhu     a1, 2(s0)
+        sw      a1, 36(s10)
+        lw      a1, 0(s0)
+        sw      a1, 40(s10)
+        lw      a1, 1(s0)
+        sw      a1, 44(s10)
+        lh      a1, 3(s0)
+        sw      a1, 48(s10)
+        lhu     a1, 3(s0)
+        sw      a1, 52(s10)
+        lw      a1, 3(s0)
+        sw      a1, 56(s10)
+        li      a0, 0xaabbccdd
+        sb      a0, 8(s0)
+        sh      a0, 10(s0)
+        sw      a0, 13(s0)
+        sh      a0, 19(s0)
+        lw      a1, 8(s0)
+        sw      a1, 60(s10)
+        lw      a1, 12(s0)
+        sw      a1, 64(s10)
+        lw      a1, 16(s0)
+        sw      a1, 68(s10)
+        lw      a1, 20(s0)
+        sw      a1, 72(s10)
+        li      a0, 0x11223344
+        sw      a0, -3(s1)
+        lw      a1, -3(s1)
+        sw      a1, 76(s10)
+        sw      a0, -2(s1)
+        lw      a1, -2(s1)
+        sw      a1, 80(s10)
+        sw      a0, -1(s1)
+        lw      a1, -1(s1)
+        sw      a1, 84(s10)
+        li      a0, 0x8765
+        sh      a0, -1(s1)
+        lh      a1, -1(s1)
+        sw      a1, 88(s10)
+        lhu     a1, -1(s1)
+        sw      a1, 92(s10)
+        lw      a1, -4(s1)
+        sw      a1, 96(s10)
+        lw      a1, 0(s1)
+        sw      a1, 100(s10)
+        addi    a0, zero, 512
+        sw      a0, 48(t6)          # malloc, right after the result buffer at 0xbb00
+        addi    s0, t3, 0
+        addi    s1, t3, 256         # page boundary in the heap
+        # heap
+        li      a0, 0x80ff7f01
+        sw      a0, 0(s0)
+        li      a0, 0x12345678
+        sw      a0, 4(s0)
+        lb      a1, 0(s0)
+        sw      a1, 104(s10)
+        lbu     a1, 0(s0)
+        sw      a1, 108(s10)
+        lb      a1, 1(s0)
+        sw      a1, 112(s10)
+        lbu     a1, 1(s0)
+        sw      a1, 116(s10)
+        lb      a1, 3(s0)
+        sw      a1, 120(s10)
+        lbu     a1, 3(s0)
+        sw      a1, 124(s10)
+        lh      a1, 0(s0)
+        sw      a1, 128(s10)
+        lhu     a1, 0(s0)
+        sw      a1, 132(s10)
+        lh      a1, 2(s0)
+        sw      a1, 136(s10)
+        lhu     a1, 2(s0)
+        sw      a1, 140(s10)
+        lw      a1, 0(s0)
+        sw      a1, 144(s10)
+        lw      a1, 1(s0)
+        sw      a1, 148(s10)
+        lh      a1, 3(s0)
+        sw      a1, 152(s10)
+        lhu     a1, 3(s0)
+        sw      a1, 156(s10)
+        lw      a1, 3(s0)
+        sw      a1, 160(s10)
+        li      a0, 0xaabbccdd
+        sb      a0, 8(s0)
+        sh      a0, 10(s0)
+        sw      a0, 13(s0)
+        sh      a0, 19(s0)
+        lw      a1, 8(s0)
+        sw      a1, 164(s10)
+        lw      a1, 12(s0)
+        sw      a1, 168(s10)
+        lw      a1, 16(s0)
+        sw      a1, 172(s10)
+        lw      a1, 20(s0)
+        sw      a1, 176(s10)
+        li      a0, 0x11223344
+        sw      a0, -3(s1)
+        lw      a1, -3(s1)
+        sw      a1, 180(s10)
+        sw      a0, -2(s1)
+        lw      a1, -2(s1)
+        sw      a1, 184(s10)
+        sw      a0, -1(s1)
+        lw      a1, -1(s1)
+        sw      a1, 188(s10)
+        li      a0, 0x8765
+        sh      a0, -1(s1)
+        lh      a1, -1(s1)
+        sw      a1, 192(s10)
+        lhu     a1, -1(s1)
+        sw      a1, 196(s10)
+        lw      a1, -4(s1)
+        sw      a1, 200(s10)
+        lw      a1, 0(s1)
+        sw      a1, 204(s10)
+        addi    s9, s10, 0
+        addi    s8, s10, 208
+print:
+        lw      a1, 0(s9)
+        sw      a1, 8(t6)
+        sb      s11, 0(t6)
+        addi    s9, s9, 4
+        bne     s9, s8, print
+        sw      zero, 12(t6)
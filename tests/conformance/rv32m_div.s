@@ -0,0 +1,117 @@
+# RV32M conformance: div, divu, rem and remu with mixed signs, division by zero and INT32_MIN / -1,
+# whose results the M extension defines, and a destination register that is also a source.
+# Results are collected in a heap buffer with no device access in between, so the JIT and AOT engines run
+# the code under test in compiled form, then printed in hex one per line. The .out file next to this one
+# holds the output every engine has to produce.
+        li      t6, 2048
+        addi    s11, zero, 10       # newline
+        addi    a0, zero, 1024
+        sw      a0, 48(t6)          # malloc the result buffer, the first block starts the heap at 0xb700
+        addi    s10, t3, 0
+        li      a0, 0x7
+        li      a1, 0xfffffffd
+        div     a2, a0, a1
+        sw      a2, 0(s10)
+        divu    a2, a0, a1
+        sw      a2, 4(s10)
+        rem     a2, a0, a1
+        sw      a2, 8(s10)
+        remu    a2, a0, a1
+        sw      a2, 12(s10)
+        li      a0, 0xfffffff9
+        li      a1, 0x2
+        div     a2, a0, a1
+        sw      a2, 16(s10)
+        divu    a2, a0, a1
+        sw      a2, 20(s10)
+        rem     a2, a0, a1
+        sw      a2, 24(s10)
+        remu    a2, a0, a1
+        sw      a2, 28(s10)
+        li      a0, 0xfffffff9
+        li      a1, 0xfffffffe
+        div     a2, a0, a1
+        sw      a2, 32(s10)
+        divu    a2, a0, a1
+        sw      a2, 36(s10)
+        rem     a2, a0, a1
+        sw      a2, 40(s10)
+        remu    a2, a0, a1
+        sw      a2, 44(s10)
+        li      a0, 0x64
+        li      a1, 0x0
+        div     a2, a0, a1
+        sw      a2, 48(s10)
+        divu    a2, a0, a1
+        sw      a2, 52(s10)
+        rem     a2, a0, a1
+        sw      a2, 56(s10)
+        remu    a2, a0, a1
+        sw      a2, 60(s10)
+        li      a0, 0xffffff9c
+        li      a1, 0x0
+        div     a2, a0, a1
+        sw      a2, 64(s10)
+        divu    a2, a0, a1
+        sw      a2, 68(s10)
+        rem     a2, a0, a1
+        sw      a2, 72(s10)
+        remu    a2, a0, a1
+        sw      a2, 76(s10)
+        li      a0, 0x80000000
+        li      a1, 0xffffffff
+        div     a2, a0, a1
+        sw      a2, 80(s10)
+        divu    a2, a0, a1
+        sw      a2, 84(s10)
+        rem     a2, a0, a1
+        sw      a2, 88(s10)
+        remu    a2, a0, a1
+        sw      a2, 92(s10)
+        li      a0, 0x80000000
+        li      a1, 0x1
+        div     a2, a0, a1
+        sw      a2, 96(s10)
+        divu    a2, a0, a1
+        sw      a2, 100(s10)
+        rem     a2, a0, a1
+        sw      a2, 104(s10)
+        remu    a2, a0, a1
+        sw      a2, 108(s10)
+        li      a0, 0x80000000
+        li      a1, 0xffffffff
+        div     a2, a0, a1
+        sw      a2, 112(s10)
+        divu    a2, a0, a1
+        sw      a2, 116(s10)
+        rem     a2, a0, a1
+        sw      a2, 120(s10)
+        remu    a2, a0, a1
+        sw      a2, 124(s10)
+        li      a0, 0xffffffff
+        li      a1, 0x2
+        div     a2, a0, a1
+        sw      a2, 128(s10)
+        divu    a2, a0, a1
+        sw      a2, 132(s10)
+        rem     a2, a0, a1
+        sw      a2, 136(s10)
+        remu    a2, a0, a1
+        sw      a2, 140(s10)
+        li      a0, -6
+        li      a1, 4
+        rem     a1, a0, a1
+        sw      a1, 144(s10)
+        li      a0, -6
+        li      a1, 4
+        div     a0, a0, a1
+        sw      a0, 148(s10)
+        addi    s9, s10, 0
+        addi    s8, s10, 152
+print:
+        lw      a1, 0(s9)
+        sw      a1, 8(t6)
+        sb      s11, 0(t6)
+        addi    s9, s9, 4
+        bne     s9, s8, print
+        sw      zero, 12(t6)
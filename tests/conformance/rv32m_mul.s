@@ -0,0 +1,88 @@
+# RV32M conformance: mul, mulh, mulhsu and mulhu over sign and overflow corners, INT32_MIN * -1 included.
+# Results are collected in a heap buffer with no device access in between, so the JIT and AOT engines run
+# the code under test in compiled form, then printed in hex one per line. The .out file next to this one
+# holds the output every engine has to produce.
+        li      t6, 2048
+        addi    s11, zero, 10       # newline
+        addi    a0, zero, 1024
+        sw      a0, 48(t6)          # malloc the result buffer, the first block starts the heap at 0xb700
+        addi    s10, t3, 0
+        li      a0, 0x7
+        li      a1, 0xfffffffd
+        mul     a2, a0, a1
+        sw      a2, 0(s10)
+        mulh    a2, a0, a1
+        sw      a2, 4(s10)
+        mulhsu  a2, a0, a1
+        sw      a2, 8(s10)
+        mulhu   a2, a0, a1
+        sw      a2, 12(s10)
+        li      a0, 0x80000000
+        li      a1, 0xffffffff
+        mul     a2, a0, a1
+        sw      a2, 16(s10)
+        mulh    a2, a0, a1
+        sw      a2, 20(s10)
+        mulhsu  a2, a0, a1
+        sw      a2, 24(s10)
+        mulhu   a2, a0, a1
+        sw      a2, 28(s10)
+        li      a0, 0x12345678
+        li      a1, 0x9abcdef0
+        mul     a2, a0, a1
+        sw      a2, 32(s10)
+        mulh    a2, a0, a1
+        sw      a2, 36(s10)
+        mulhsu  a2, a0, a1
+        sw      a2, 40(s10)
+        mulhu   a2, a0, a1
+        sw      a2, 44(s10)
+        li      a0, 0xffffffff
+        li      a1, 0xffffffff
+        mul     a2, a0, a1
+        sw      a2, 48(s10)
+        mulh    a2, a0, a1
+        sw      a2, 52(s10)
+        mulhsu  a2, a0, a1
+        sw      a2, 56(s10)
+        mulhu   a2, a0, a1
+        sw      a2, 60(s10)
+        li      a0, 0x7fffffff
+        li      a1, 0x7fffffff
+        mul     a2, a0, a1
+        sw      a2, 64(s10)
+        mulh    a2, a0, a1
+        sw      a2, 68(s10)
+        mulhsu  a2, a0, a1
+        sw      a2, 72(s10)
+        mulhu   a2, a0, a1
+        sw      a2, 76(s10)
+        li      a0, 0x80000000
+        li      a1, 0x80000000
+        mul     a2, a0, a1
+        sw      a2, 80(s10)
+        mulh    a2, a0, a1
+        sw      a2, 84(s10)
+        mulhsu  a2, a0, a1
+        sw      a2, 88(s10)
+        mulhu   a2, a0, a1
+        sw      a2, 92(s10)
+        li      a0, 0xfffffffb
+        li      a1, 0xfffffffb
+        mul     a2, a0, a1
+        sw      a2, 96(s10)
+        mulh    a2, a0, a1
+        sw      a2, 100(s10)
+        mulhsu  a2, a0, a1
+        sw      a2, 104(s10)
+        mulhu   a2, a0, a1
+        sw      a2, 108(s10)
+        addi    s9, s10, 0
+        addi    s8, s10, 112
+print:
+        lw      a1, 0(s9)
+        sw      a1, 8(t6)
+        sb      s11, 0(t6)
+        addi    s9, s9, 4
+        bne     s9, s8, print
+        sw      zero, 12(t6)
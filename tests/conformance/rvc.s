@@ -0,0 +1,145 @@
+# RVC conformance: every compressed instruction the VM expands, mixed with 4-byte instructions that sit at
+# 2-mod-4 addresses, in loops, calls and branches. Results are collected in a heap buffer with no device access
+# in between, so the JIT and AOT engines run the code under test in compiled form, then printed in hex one per
+# line. The .out file next to this one holds the output every engine has to produce.
+        li      t6, 2048
+        addi    s11, zero, 10       # newline
+        addi    a0, zero, 1024
+        sw      a0, 48(t6)          # malloc the result buffer, the first block starts the heap at 0xb700
+        addi    s10, t3, 0
+        addi    sp, t3, 512         # sp-relative scratch in the upper half of the buffer
+        c.nop                       # from here on 4-byte instructions start at 2 mod 4
+        # c.li, c.addi, c.lui, c.mv, c.add
+        c.li    a0, -5
+        sw      a0, 0(s10)
+        c.addi  a0, 31
+        sw      a0, 4(s10)
+        c.lui   a1, 0x1f
+        sw      a1, 8(s10)
+        c.lui   a1, 0x3f
+        sw      a1, 12(s10)
+        c.mv    a2, a0
+        sw      a2, 16(s10)
+        c.add   a2, a1
+        sw      a2, 20(s10)
+        # c.sub, c.xor, c.or, c.and and c.andi on x8-x15
+        li      a3, 0xf0f0
+        li      a4, 0x0ff0
+        c.mv    a5, a3
+        c.sub   a5, a4
+        sw      a5, 24(s10)
+        c.mv    a5, a3
+        c.xor   a5, a4
+        sw      a5, 28(s10)
+        c.mv    a5, a3
+        c.or    a5, a4
+        sw      a5, 32(s10)
+        c.mv    a5, a3
+        c.and   a5, a4
+        sw      a5, 36(s10)
+        c.mv    a5, a3
+        c.andi  a5, 0x13
+        sw      a5, 40(s10)
+        c.mv    a5, a3
+        c.andi  a5, -32
+        sw      a5, 44(s10)
+        c.li    a5, -1
+        c.sub   a5, a3
+        sw      a5, 48(s10)
+        # sp-relative loads and stores, c.addi16sp and c.addi4spn
+        c.swsp  a3, 8(sp)
+        c.lwsp  s0, 8(sp)
+        sw      s0, 52(s10)
+        c.addi16sp -32
+        c.swsp  a4, 44(sp)        # 12 above the old sp
+        c.addi16sp 32
+        c.lwsp  s1, 12(sp)
+        sw      s1, 56(s10)
+        c.addi16sp 496
+        c.addi16sp -496
+        c.lwsp  s1, 12(sp)
+        sw      s1, 60(s10)
+        c.addi4spn a0, 16
+        sub     a5, a0, sp
+        sw      a5, 64(s10)
+        c.sw    a3, 0(a0)
+        c.lwsp  a2, 16(sp)
+        sw      a2, 68(s10)
+        c.swsp  a4, 140(sp)
+        c.lw    a1, 124(a0)
+        sw      a1, 72(s10)
+        c.addi4spn a1, 1020
+        sub     a5, a1, sp
+        sw      a5, 76(s10)
+        c.swsp  a1, 252(sp)
+        c.lwsp  a2, 252(sp)
+        sub     a2, a2, a1
+        sw      a2, 80(s10)
+        # counted loops closed by c.bnez and by a 4-byte branch at 2 mod 4
+        c.li    s0, 5
+        c.li    s1, 0
+countdown:
+        c.add   s1, s0
+        addi    s1, s1, 100
+        c.addi  s0, -1
+        c.bnez  s0, countdown
+        sw      s1, 84(s10)
+        c.li    s0, 0
+        c.li    a2, 0
+        c.li    a3, 7
+        c.nop
+countup:
+        c.addi  s0, 1
+        c.add   a2, s0
+        bne     s0, a3, countup
+        sw      a2, 88(s10)
+        # c.beqz and c.bnez taken and not taken, skipping markers that must not run
+        c.li    a0, 0
+        c.li    a1, 1
+        c.li    a2, 0
+        c.beqz  a0, beqzTaken
+        c.addi  a2, 1
+beqzTaken:
+        c.beqz  a1, beqzSkipped
+        c.addi  a2, 2
+beqzSkipped:
+        c.bnez  a0, bnezSkipped
+        c.addi  a2, 4
+bnezSkipped:
+        c.bnez  a1, bnezTaken
+        c.addi  a2, 8
+bnezTaken:
+        sw      a2, 92(s10)
+        # c.j over an illegal halfword, c.jal and c.jalr calls returning with c.jr
+        c.j     overIllegal
+        .half   0
+overIllegal:
+        c.li    a0, 3
+        c.jal   double
+afterDouble:
+        sw      a0, 96(s10)
+        addi    a5, ra, 0
+        sw      a5, 100(s10)
+        c.mv    a4, ra
+        addi    a4, a4, 42
+        c.jalr  a4
+afterJalr:
+        sw      a0, 104(s10)
+        addi    a5, ra, 0
+        sw      a5, 108(s10)
+        jal     ra, double
+        sw      a0, 112(s10)
+        c.j     finish
+double:
+        c.add   a0, a0
+        c.jr    ra
+finish:
+        addi    s9, s10, 0
+        addi    s8, s10, 116
+print:
+        lw      a1, 0(s9)
+        sw      a1, 8(t6)
+        sb      s11, 0(t6)
+        addi    s9, s9, 4
+        bne     s9, s8, print
+        sw      zero, 12(t6)
@@ -0,0 +1,53 @@
+# sra as every engine implements it (the interpreter's semantics): one arithmetic shift per step with the old
+# low bit ORed into bit 31, repeated rs2 times, and with rd == rs2 the count is re-read from rd on every step.
+# Results are collected in a heap buffer with no device access in between, then printed in hex one per line.
+        li      t6, 2048
+        addi    s11, zero, 10       # newline
+        addi    a0, zero, 64
+        sw      a0, 48(t6)          # malloc the result buffer
+        addi    s10, t3, 0
+        li      a0, 0xfffffffe
+        addi    a1, zero, 1
+        sra     a2, a0, a1
+        sw      a2, 0(s10)
+        li      a0, 0x80000001
+        addi    a1, zero, 1
+        sra     a2, a0, a1
+        sw      a2, 4(s10)
+        li      a0, 0x6
+        addi    a1, zero, 2
+        sra     a2, a0, a1
+        sw      a2, 8(s10)
+        li      a0, 0xfffffff8
+        addi    a1, zero, 3
+        sra     a2, a0, a1
+        sw      a2, 12(s10)
+        li      a0, 0x12345678
+        addi    a1, zero, 0
+        sra     a2, a0, a1
+        sw      a2, 16(s10)
+        li      a0, 0xffffffff
+        addi    a1, zero, 5
+        sra     a2, a0, a1
+        sw      a2, 20(s10)
+        li      a0, 0x70000000
+        addi    a1, zero, 4
+        sra     a2, a0, a1
+        sw      a2, 24(s10)
+        li      a0, 0x8
+        addi    a1, zero, 0
+        sra     a1, a0, a1          # rd == rs2
+        sw      a1, 28(s10)
+        li      a0, 0xfffffffe
+        addi    a1, zero, 3
+        sra     a1, a0, a1          # rd == rs2
+        sw      a1, 32(s10)
+        addi    s9, s10, 0
+        addi    s8, s10, 36
+print:
+        lw      a1, 0(s9)
+        sw      a1, 8(t6)
+        sb      s11, 0(t6)
+        addi    s9, s9, 4
+        bne     s9, s8, print
+        sw      zero, 12(t6)
@@ -0,0 +1,49 @@
+#!/bin/sh
+# Conformance checks: every tests/conformance/*.mi image runs on each engine and its console output has to
+# match the .out file next to it byte for byte. The images are built from the .s sources with bench/rxasm.py.
+# A mixed batch of snapshots and images then checks that every job gets its own memory layout.
+#
+#   gcc -O2 -pthread -o riscv_vm vm_riskxvii.c -ldl
+#   tests/run.sh [vm binary]   # defaults to ./riscv_vm
+vm=${1:-./riscv_vm}
+dir=$(dirname "$0")/conformance
+cache=$(mktemp -d) || exit 1 # a fresh AOT cache, so every run compiles the current translator's output
+actual="$cache/actual"
+failures=0
+for image in "$dir"/*.mi; do
+    name=$(basename "$image" .mi)
+    for engine in switch threaded jit aot; do
+        # a JIT threshold of 1 compiles every block on its first entry
+        "$vm" --engine $engine --jit-threshold 1 --aot-cache "$cache" "$image" < /dev/null > "$actual" # stderr notes such as an unavailable AOT compiler are not guest output
+        if cmp -s "$actual" "$dir/$name.out"; then
+            echo "ok   $name $engine"
+        else
+            echo "FAIL $name $engine"
+            diff "$dir/$name.out" "$actual" | head -10
+            failures=$((failures + 1))
+        fi
+    done
+done
+
+# A batch worker reuses one VM, so a snapshot saved with a different memory layout must not leak into the plain
+# images it runs next. Snapshots sit on both sides of the images since a worker takes its own jobs last-in first.
+batch="$cache/batch"
+mkdir -p "$batch/jobs" "$batch/out"
+{ head -c 1024 "$dir/sra.mi"; head -c 7168 /dev/zero; } > "$batch/big.mi" # the same code in a 4K,4K layout
+"$vm" --memory 4K,4K,8K --snapshot "$batch/jobs/0_big.snap" --snapshot-at 1 "$batch/big.mi" > /dev/null 2>&1
+cp "$batch/jobs/0_big.snap" "$batch/jobs/2_big.snap"
+cp "$dir/sra.mi" "$batch/jobs/1_sra.mi"
+cp "$dir/sra.mi" "$batch/jobs/3_sra.mi"
+"$vm" --jobs 1 --output-dir "$batch/out" --batch "$batch/jobs" > /dev/null 2>&1
+for job in 0_big.snap 1_sra.mi 2_big.snap 3_sra.mi; do
+    if cmp -s "$batch/out/$job.out" "$dir/sra.out"; then
+        echo "ok   batch $job"
+    else
+        echo "FAIL batch $job"
+        failures=$((failures + 1))
+    fi
+done
+
+rm -rf "$cache"
+echo "$failures failure(s)"
+[ $failures -eq 0 ]
@@ -1,50 +1,197 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE // MAP_ANONYMOUS
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
-#include <math.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <sys/uio.h>
+#include <poll.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <spawn.h>
+#include <dlfcn.h>
 
-#define INST_MEM_SIZE 1024
-#define DATA_MEM_SIZE 1024
-#define HEAP_SIZE 64
-#define NUM_BANKS 128
+#include "vm_riskxvii.h"
+
+#define HEAP_SIZE 64 // bytes per bank
 #define NUM_REGS 32
+#define HEAP_START 46848 // the heap stays here unless data memory reaches past it
+#define DEVICE_START 0x800
+#define DMA_COPY 1 // DMA command words
+#define DMA_FILL 2
+#define PAGE_BITS 8
+#define PAGE_SIZE (1 << PAGE_BITS)
+#define MIN_GUEST_SPACE 0x10000 // the page table covers at least this much, addresses past the last region fault
+#define HOST_PAGE_SIZE 4096     // regions start on host pages inside the reservation so each can be dropped on its own
+#define HUGE_PAGE_SIZE (2u << 20)
+#define MADVISE_CLEAR_SIZE (64u << 10) // regions this big are zeroed by dropping their pages instead of memset
+
+#ifndef TRACE_SUPPORT
+#define TRACE_SUPPORT 1 // build with -DTRACE_SUPPORT=0 to leave the traced engine out of the binary
+#endif
+#ifndef JIT_SUPPORT
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__)) && !defined(_WIN32)
+#define JIT_SUPPORT 1 // build with -DJIT_SUPPORT=0 to leave the x86-64 JIT out
+#else
+#define JIT_SUPPORT 0
+#endif
+#endif
+#ifndef AOT_SUPPORT
+#define AOT_SUPPORT 1 // build with -DAOT_SUPPORT=0 where there is no dlopen or C compiler at run time
+#endif
+#define AOT_VERSION 7 // part of every cache file name, bump when the generated code changes
+#define JIT_CODE_SIZE (1 << 20) // machine code buffer per VM, mapped on the first compile
+#define TRACE_MAGIC 0x32545852 // "RXT2", 32-bit pcs
+#define PROFILE_HOT_BLOCKS 10 // blocks listed in a profile report
+#define SCHEDULER_STEAL_MAX 64    // guests taken from a peer in one go
+#define SCHEDULER_POLL_INTERVAL 64 // quanta between polls of parked guests while others are runnable
+#define SCHEDULER_IDLE_POLL_MS 10  // wait for input this long before looking for work to steal again
+#define SNAPSHOT_MAGIC 0x4e535852 // "RXSN" in a little-endian file
+#define SNAPSHOT_VERSION 4
 
-int debugga = 1;
-int regs[NUM_REGS] = {0};
-struct Node *head = NULL;
-int pc = 0;
-unsigned int allocCounter = 1;
-unsigned int rawInstruction;
+#if defined(__GNUC__) || defined(__clang__)
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define ALWAYS_INLINE inline
+#endif
 
-struct Node
+enum OpHandler // one entry per instruction the VM can execute, indexes the decoded program
 {
-    unsigned int startingAddress;
-    int allocated;
-    unsigned char heap[HEAP_SIZE];
-    struct Node *next;
+    OP_ADD,
+    OP_SUB,
+    OP_XOR,
+    OP_OR,
+    OP_AND,
+    OP_SLL,
+    OP_SRL,
+    OP_SRA,
+    OP_SLT,
+    OP_SLTU,
+    OP_ADDI,
+    OP_XORI,
+    OP_ORI,
+    OP_ANDI,
+    OP_SLTI,
+    OP_SLTIU,
+    OP_LB,
+    OP_LH,
+    OP_LW,
+    OP_LBU,
+    OP_LHU,
+    OP_JALR,
+    OP_SB,
+    OP_SH,
+    OP_SW,
+    OP_BEQ,
+    OP_BNE,
+    OP_BLT,
+    OP_BLTU,
+    OP_BGE,
+    OP_BGEU,
+    OP_LUI,
+    OP_JAL,
+    OP_MUL, // RV32M
+    OP_MULH,
+    OP_MULHSU,
+    OP_MULHU,
+    OP_DIV,
+    OP_DIVU,
+    OP_REM,
+    OP_REMU,
+    OP_FAR_BRANCH, // branch or jal whose target failed the load-time check, rd holds the original handler
+    OP_NOT_IMPLEMENTED,
+    OP_END_OF_PROGRAM, // sentinel slot just past instruction memory, the only way pc reaches its end is falling through to it
+    NUM_OP_HANDLERS
 };
 
-typedef struct
+const char *opNames[NUM_OP_HANDLERS] = {
+    "add", "sub", "xor", "or", "and", "sll", "srl", "sra", "slt", "sltu",
+    "addi", "xori", "ori", "andi", "slti", "sltiu",
+    "lb", "lh", "lw", "lbu", "lhu", "jalr",
+    "sb", "sh", "sw",
+    "beq", "bne", "blt", "bltu", "bge", "bgeu",
+    "lui", "jal",
+    "mul", "mulh", "mulhsu", "mulhu", "div", "divu", "rem", "remu",
+    "far branch", "not implemented", "end of program"};
+
+typedef struct // an instruction decoded once at load time, 8 bytes so a cache line holds 8 of them
+{
+    uint8_t handler : 7;    // OpHandler
+    uint8_t compressed : 1; // expanded from a 2-byte RVC encoding, pc advances by 2
+    uint8_t rd;
+    uint8_t rs1;
+    uint8_t rs2;
+    int32_t imm; // the single immediate the handler uses, already sign extended
+} DecodedOp;
+
+static inline int opLength(const DecodedOp *op) // bytes pc moves past op when it falls through
+{
+    return op->compressed ? 2 : 4;
+}
+
+typedef struct // counters of the profiled engine, allocated only while profiling is on
+{
+    uint64_t deviceLoads[PAGE_SIZE]; // per byte address of the device page
+    uint64_t deviceStores[PAGE_SIZE];
+    uint64_t *executed; // per instruction slot, per-opcode counts are summed from these
+    uint64_t *taken;    // times the instruction left pc somewhere other than the next instruction
+    uint64_t slots[];   // executed then taken, one slot count each
+} Profile;
+
+typedef uint64_t (*JitBlock)(int *regs, unsigned char *heap); // compiled block: retired instructions << 32 | next pc | flags
+typedef int (*AotRun)(int *regs, unsigned char *heap, int pc, uint64_t *budget); // translated image: returns the pc the interpreter takes over at
+
+enum FusedOp // superinstructions for the threaded engine, the handler of the first slot of the idiom is replaced
 {
-    unsigned char inst_mem[INST_MEM_SIZE];
-    unsigned char data_mem[DATA_MEM_SIZE];
-} MachineInstructions;
+    FUSE_NONE,
+    FUSE_LUI_ADDI_SW, // li of a device address straight into a store: lui+addi+sw
+    FUSE_LUI_ADDI,    // 32-bit constant materialisation, folded into one register write
+    FUSE_ADDI_SW,
+    FUSE_SLT_BNE,     // compare then branch on the flag
+    FUSE_SLT_BEQ,
+    FUSE_SLTU_BNE,
+    FUSE_SLTU_BEQ,
+    NUM_FUSED_OPS
+};
 
 typedef struct
 {
-    unsigned int opcode;
-    unsigned int rd;
-    unsigned int rs1;
-    unsigned int rs2;
-    unsigned int func3;
-    unsigned int func7;
+    const char *name;
+    uint8_t length;
+    uint8_t handlers[3];                  // OpHandler of each instruction in program order
+    int (*matches)(const DecodedOp *ops); // operand conditions on top of the handlers, NULL when any operands fuse
+} FusionRule;
+
+int fuseLuiAddi(const DecodedOp *ops) // addi completes the constant the lui started
+{
+    return ops[1].rd == ops[0].rd && ops[1].rs1 == ops[0].rd;
+}
+
+int fuseLuiAddiStore(const DecodedOp *ops)
+{
+    return fuseLuiAddi(ops) && ops[2].rs1 == ops[0].rd;
+}
 
-    int immI;
-    int immS;
-    int immSB;
-    int immU;
-    int immUJ;
-} Instruction;
+// Tried in order at every slot, so longer idioms come before their own prefixes. Adding a rule takes an
+// entry here, its FusedOp and a fused handler in runThreaded().
+const FusionRule fusionRules[NUM_FUSED_OPS] = {
+    [FUSE_NONE] = {"none", 0, {0}, NULL},
+    [FUSE_LUI_ADDI_SW] = {"lui+addi+sw", 3, {OP_LUI, OP_ADDI, OP_SW}, fuseLuiAddiStore},
+    [FUSE_LUI_ADDI] = {"lui+addi", 2, {OP_LUI, OP_ADDI}, fuseLuiAddi},
+    [FUSE_ADDI_SW] = {"addi+sw", 2, {OP_ADDI, OP_SW}, NULL},
+    [FUSE_SLT_BNE] = {"slt+bne", 2, {OP_SLT, OP_BNE}, NULL},
+    [FUSE_SLT_BEQ] = {"slt+beq", 2, {OP_SLT, OP_BEQ}, NULL},
+    [FUSE_SLTU_BNE] = {"sltu+bne", 2, {OP_SLTU, OP_BNE}, NULL},
+    [FUSE_SLTU_BEQ] = {"sltu+beq", 2, {OP_SLTU, OP_BEQ}, NULL}};
 
 typedef union
 {
@@ -52,1067 +199,4815 @@ typedef union
     unsigned int u;
 } Immediate;
 
-void dumpRegisters()
+typedef struct // 12 bytes per retired instruction
+{
+    uint32_t pc;
+    uint8_t handler;
+    uint8_t rd;
+    uint16_t unused;
+    int32_t rdValue; // regs[rd] after the instruction ran
+} TraceRecord;
+
+typedef struct // header of a trace file, followed by min(recorded, capacity) records oldest first
+{
+    uint32_t magic;
+    uint32_t capacity;
+    uint64_t recorded; // every instruction traced, older ones were overwritten in the ring
+} TraceFileHeader;
+
+// A snapshot file is this header followed by instruction and data memory, the heap, the bank bitmap and the
+// allocation lengths, each as the VM holds it, so restoring from an mmap of it is a handful of memcpys.
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size; // sizeof(SnapshotFile), rejects files written by a build with a different layout
+    int32_t pc;
+    uint64_t instructionsExecuted;
+    int32_t regs[NUM_REGS];
+    uint32_t status;
+    HeapStats heapStats;
+    uint32_t instructionSize; // the memory layout the contents belong to
+    uint32_t dataSize;
+    uint32_t heapSize;
+    uint32_t dmaSource; // DMA device registers
+    uint32_t dmaDestination;
+    uint32_t dmaLength;
+    uint32_t writePointer; // console block write device
+    uint32_t unused;
+} SnapshotFile;
+
+enum PageKind
+{
+    PAGE_FAULT,
+    PAGE_ROM,
+    PAGE_RAM,
+    PAGE_DEVICE
+};
+
+typedef struct // one page of the guest address space
+{
+    uint8_t kind;         // PageKind
+    unsigned char *read;  // host memory behind the page, NULL when loads go to a device or fault
+    unsigned char *write; // NULL for read-only pages as well
+} MemoryPage;
+
+struct VM
+{
+    VMMemoryConfig memory;
+    unsigned char *arena; // the one mmap holding instruction memory, data memory and the heap
+    size_t arenaSize;
+    int hugetlb;          // the arena came from the huge page pool
+    int instSize;
+    int dataSize;
+    int numSlots;         // decoded slots, one per halfword of instruction memory since compressed instructions are 2 bytes long
+    unsigned char *instMemory;
+    unsigned char *dataMemory;
+    unsigned int guestSpace; // addresses at or above this fault
+
+    unsigned char *heapMemory; // every bank back to back, bank i starts at heapStart + i * HEAP_SIZE
+    unsigned int heapStart;
+    unsigned int heapEnd;
+    unsigned int numBanks;
+    unsigned int bankWords;
+    uint64_t *bankBitmap;       // bit i of the heap is set while bank i is allocated
+    uint32_t *allocationBanks;  // length in banks of the allocation starting at each bank, 0 otherwise
+    HeapStats heapStats;
+
+    MemoryPage *pages;
+
+    int regs[NUM_REGS];
+    int pc;
+    VMStatus status;
+    uint64_t instructionsExecuted;
+    unsigned int dmaSource; // DMA device registers, a command word acts on them
+    unsigned int dmaDestination;
+    unsigned int dmaLength;
+    unsigned int writePointer; // guest address the next console block write starts at
+
+    VMEngine engine;
+    FILE *input;
+    FILE *output;
+    int inputFd;           // descriptor behind input, -1 for streams without one
+    int inputNonBlocking;  // park the guest with VM_WAITING_INPUT instead of blocking in read()
+    int inputEof;
+    unsigned char *inputBuffer; // console input read ahead in large chunks, inputStart .. inputEnd not parsed yet
+    size_t inputStart;
+    size_t inputEnd;
+    size_t inputCapacity;
+    char *outputBuffer; // console output waiting to be written, NULL when unbuffered
+    size_t outputLength;
+    size_t outputCapacity;
+    unsigned int flushPolicy; // VMFlushPolicy bits
+    int snapshotTrigger;      // writes to the snapshot device stop vmRun with VM_SNAPSHOT_POINT
+
+    DecodedOp *decodedOps; // numSlots + the end of program sentinel, every halfword decoded as if an instruction started there
+    void **threadedCode;   // handler address per slot for the threaded engine, filled on its first run
+    int threadedReady;
+    int fusion;            // let the threaded engine use superinstructions
+    uint8_t *fusedOps;     // FusedOp starting at each slot, found by fuseOps()
+    FusionStats fusionStats;
+
+    unsigned char *jitCode; // mmap'd buffer holding every compiled block of this VM
+    size_t jitUsed;
+    JitBlock *jitBlocks;  // compiled block starting at each slot
+    uint8_t *jitLengths;  // most instructions the block can retire in one call
+    uint16_t *jitCounts;  // block entries seen by the interpreter
+    unsigned int jitThreshold;
+    uint64_t jitBudget; // instructions a compiled loop may still retire, addressed by the block relative to regs
+    JitStats jitStats;
+
+    void *aotHandle; // dlopen handle of the translated image
+    AotRun aotRun;
+    int aotTried;      // translation was attempted for the current image, successfully or not
+    char *aotCacheDir; // NULL for the default
+
+    Profile *profile; // NULL unless profiling
+
+    TraceLevel traceLevel;
+    TraceRecord *traceRing;
+    uint32_t traceCapacity; // power of two so the ring index is a mask
+    uint64_t traceRecorded;
+    int traceParked; // the instruction at pc parked on console input and has been traced already
+};
+
+int writeAll(int fd, struct iovec *chunks, int count) // writev until every chunk is out, -1 on a write error
+{
+    while (count > 0)
+    {
+        ssize_t written = writev(fd, chunks, count);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        for (; count > 0 && (size_t)written >= chunks->iov_len; count--, chunks++) // drop the chunks that went out completely
+        {
+            written -= chunks->iov_len;
+        }
+        if (count > 0)
+        {
+            chunks->iov_base = (char *)chunks->iov_base + written;
+            chunks->iov_len -= written;
+        }
+    }
+    return 0;
+}
+
+void writeConsole(VM *vm, const char *extra, size_t extraLength) // write the buffer and then extra in one call
+{
+    struct iovec chunks[2] = {{vm->outputBuffer, vm->outputLength}, {(void *)extra, extraLength}};
+    int fd = fileno(vm->output);
+    fflush(vm->output); // anything the host printed through stdio goes first
+    if (fd < 0 || writeAll(fd, chunks, 2) != 0) // streams without a descriptor (fmemopen and the like) go through stdio
+    {
+        fwrite(vm->outputBuffer, 1, vm->outputLength, vm->output);
+        fwrite(extra, 1, extraLength, vm->output);
+        fflush(vm->output);
+    }
+    vm->outputLength = 0;
+}
+
+void vmFlushOutput(VM *vm)
+{
+    if (vm->outputLength > 0)
+    {
+        writeConsole(vm, NULL, 0);
+    }
+}
+
+void consoleWrite(VM *vm, const char *text, size_t length)
+{
+    if (vm->outputLength + length > vm->outputCapacity) // full, or unbuffered: write everything out together
+    {
+        writeConsole(vm, text, length);
+        return;
+    }
+    memcpy(vm->outputBuffer + vm->outputLength, text, length);
+    vm->outputLength += length;
+    if ((vm->flushPolicy & VM_FLUSH_NEWLINE) && memchr(text, '\n', length) != NULL)
+    {
+        writeConsole(vm, NULL, 0);
+    }
+}
+
+void consolePrintf(VM *vm, const char *format, ...)
+{
+    char text[64]; // the longest device or dump line is well under this
+    va_list arguments;
+    va_start(arguments, format);
+    int length = vsnprintf(text, sizeof(text), format, arguments);
+    va_end(arguments);
+    consoleWrite(vm, text, length < (int)sizeof(text) ? (size_t)length : sizeof(text) - 1);
+}
+
+int vmSetOutputBuffer(VM *vm, size_t capacity, unsigned int flushPolicy)
+{
+    vmFlushOutput(vm);
+    char *buffer = NULL;
+    if (capacity > 0)
+    {
+        buffer = malloc(capacity);
+        if (buffer == NULL)
+        {
+            return -1;
+        }
+    }
+    free(vm->outputBuffer);
+    vm->outputBuffer = buffer;
+    vm->outputCapacity = capacity;
+    vm->flushPolicy = flushPolicy;
+    return 0;
+}
+
+void dumpRegisters(VM *vm)
 {
-    printf("PC = 0x%08x;\n", pc);
+    consolePrintf(vm, "PC = 0x%08x;\n", vm->pc);
     for (int i = 0; i < NUM_REGS; i++)
     {
-        printf("R[%d] = 0x%08x;\n", i, regs[i]);
+        consolePrintf(vm, "R[%d] = 0x%08x;\n", i, vm->regs[i]);
     }
 }
 
-void notImplemented(unsigned int rawInstruction)
+// Guest memory is little-endian. These move a whole value at a time; memcpy keeps unaligned addresses
+// legal and compiles to a single load or store on hosts that allow unaligned access.
+static inline uint32_t load32(const unsigned char *source)
 {
-    printf("Instruction Not Implemented: 0x%08x\n", rawInstruction);
-    dumpRegisters();
-    exit(0);
+    uint32_t value;
+    memcpy(&value, source, 4);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap32(value);
+#endif
+    return value;
 }
 
-void illegalOperation(unsigned int rawInstruction)
+static inline uint16_t load16(const unsigned char *source)
 {
-    printf("Illegal Operation: 0x%08x\n", rawInstruction);
-    dumpRegisters();
-    exit(0);
+    uint16_t value;
+    memcpy(&value, source, 2);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap16(value);
+#endif
+    return value;
 }
 
-int virtualWriteCheck(unsigned int memAdress, unsigned int value)
+static inline void store32(unsigned char *target, uint32_t value)
 {
-    switch (memAdress)
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap32(value);
+#endif
+    memcpy(target, &value, 4);
+}
+
+static inline void store16(unsigned char *target, uint16_t value)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap16(value);
+#endif
+    memcpy(target, &value, 2);
+}
+
+unsigned int rawInstructionAt(const VM *vm, int address) // compressed instructions and the last halfword come back as 16 bits
+{
+    unsigned int low = load16(vm->instMemory + address);
+    if ((low & 0b11) != 0b11 || address + 4 > vm->instSize)
     {
-    case 2048: // Console Write Character
-        printf("%c", value);
-        return 1;
-    case 2052: // Console Write Signed Integer
-        printf("%d", value);
-        return 1;
-    case 2056: // Console Write Unsigned Integer
-        printf("%x", value);
-        return 1;
-    case 2060: // HALT
-        printf("CPU Halt Requested\n");
-        exit(1);
-    case 2080: // Dump PC
-        printf("%x\n", pc);
-        return 1;
-    case 2084: // Dump Register Banks
-        dumpRegisters();
-        return 1;
-    case 2088: // Dump Memory Word
+        return low;
+    }
+    return load32(vm->instMemory + address);
+}
+
+void notImplemented(VM *vm)
+{
+    consolePrintf(vm, "Instruction Not Implemented: 0x%08x\n", rawInstructionAt(vm, vm->pc));
+    dumpRegisters(vm);
+    vm->status = VM_NOT_IMPLEMENTED;
+}
+
+void illegalOperation(VM *vm)
+{
+    consolePrintf(vm, "Illegal Operation: 0x%08x\n", rawInstructionAt(vm, vm->pc));
+    dumpRegisters(vm);
+    vm->status = VM_ILLEGAL_OPERATION;
+}
+
+// The guest address space is routed through one table of 256-byte pages: instruction memory is
+// readable, data memory and the heap are readable and writable, the device page goes to the virtual
+// routines and everything else faults. Plain memory pages hold host pointers, so a load or store is
+// one lookup and one compare on the fast path.
+void mapMemory(VM *vm)
+{
+    memset(vm->pages, 0, (vm->guestSpace / PAGE_SIZE) * sizeof(MemoryPage));
+    for (int page = 0; page < vm->instSize / PAGE_SIZE; page++)
+    {
+        vm->pages[page] = (MemoryPage){PAGE_ROM, vm->instMemory + page * PAGE_SIZE, NULL}; // stores would go stale in the decoded program
+    }
+    for (int page = 0; page < vm->dataSize / PAGE_SIZE; page++)
+    {
+        unsigned char *host = vm->dataMemory + page * PAGE_SIZE;
+        vm->pages[vm->instSize / PAGE_SIZE + page] = (MemoryPage){PAGE_RAM, host, host};
+    }
+    vm->pages[DEVICE_START / PAGE_SIZE] = (MemoryPage){PAGE_DEVICE, NULL, NULL}; // over whatever region reaches this far
+    for (unsigned int page = 0; page < (vm->heapEnd - vm->heapStart) / PAGE_SIZE; page++)
+    {
+        unsigned char *host = vm->heapMemory + page * PAGE_SIZE;
+        vm->pages[vm->heapStart / PAGE_SIZE + page] = (MemoryPage){PAGE_RAM, host, host};
+    }
+}
+
+unsigned char *straddlingAddress(VM *vm, unsigned int address, unsigned int size, int write) // an access running into the next page
+{
+    unsigned int last = address + size - 1;
+    if (address >= vm->guestSpace || last >= vm->guestSpace || last < address)
+    {
+        return NULL;
+    }
+    const MemoryPage *first = &vm->pages[address >> PAGE_BITS];
+    const MemoryPage *second = &vm->pages[last >> PAGE_BITS];
+    unsigned char *host = write ? first->write : first->read;
+    unsigned char *next = write ? second->write : second->read;
+    if (host == NULL || next != host + PAGE_SIZE) // both pages have to be the same block of host memory
+    {
+        return NULL;
+    }
+    return host + (address & (PAGE_SIZE - 1));
+}
+
+static inline unsigned char *loadAddress(VM *vm, unsigned int address, unsigned int size) // host pointer for a load, NULL when it is not plain memory
+{
+    if (address < vm->guestSpace)
     {
-        struct Node *current = head;
-        for (int i = 0; i < NUM_BANKS; i++)
+        unsigned char *host = vm->pages[address >> PAGE_BITS].read;
+        unsigned int offset = address & (PAGE_SIZE - 1);
+        if (host != NULL && offset + size <= PAGE_SIZE)
         {
-            if (current->next->startingAddress > value)
-            {
-                unsigned int memWord = current->heap[value - current->startingAddress];
-                printf("%x\n", memWord);
-                return 1;
-            }
-            current = current->next;
+            return host + offset;
         }
-        return 0;
     }
-    case 2096: // malloc
+    return straddlingAddress(vm, address, size, 0);
+}
+
+static inline unsigned char *storeAddress(VM *vm, unsigned int address, unsigned int size)
+{
+    if (address < vm->guestSpace)
     {
-        struct Node *current = head;
-        int banksRequired = (int)ceil(sizeof(value) / 64);
-        for (int i = 0; i < NUM_BANKS; i++)
+        unsigned char *host = vm->pages[address >> PAGE_BITS].write;
+        unsigned int offset = address & (PAGE_SIZE - 1);
+        if (host != NULL && offset + size <= PAGE_SIZE)
         {
-            if (!current->allocated) // if the current is not allocated...
-            {
-                if (banksRequired == 1) // and the number of banks required is 1, we have found space
-                {
-                    current->allocated = allocCounter++;
-                    regs[28] = current->startingAddress;
-                    return 1;
-                }
-                struct Node *tempCurrent = current;
-                for (int j = 1; j < banksRequired; j++) // otherwise check that there is space in adjacent banks
-                {
-                    if (tempCurrent->next != NULL) // if the next bank exists...
-                    {
-                        if (!tempCurrent->next->allocated) // and it is not allocated
-                        {
-                            if (banksRequired == j + 1) // and this is enough banks
-                            {
-                                regs[28] = current->startingAddress;
-                                for (int k = 0; k < banksRequired; k++) // allocate banks equal to the number of banks required
-                                {
-                                    current->allocated = allocCounter++;
-                                    current = current->next;
-                                }
-                                return 1;
-                            }
-                            tempCurrent = tempCurrent->next; // set tempCurrent to its own next node if we havn't enough banks yet
-                        }
-                        else
-                        {
-                            current = tempCurrent; // if the node isn't allocated, continue the outer loop from tempCurrent
-                            break;
-                        }
-                    }
-                    else
-                    {
-                        regs[28] = 0; // if there is no next node (we already checked if the banks required was 1) there is not enough space
-                        return 0;     // failure to allocate  will need error handling
-                    }
-                }
-            }
+            return host + offset;
         }
-        return 1;
     }
-    case 2100: // free
+    return straddlingAddress(vm, address, size, 1);
+}
+
+int devicePage(const VM *vm, unsigned int address)
+{
+    return address < vm->guestSpace && vm->pages[address >> PAGE_BITS].kind == PAGE_DEVICE;
+}
+
+#if defined(__GNUC__) || defined(__clang__)
+#define bitCount64(x) __builtin_popcountll(x)
+#define lowestSetBit64(x) __builtin_ctzll(x)
+#else
+int bitCount64(uint64_t x)
+{
+    int count = 0;
+    for (; x; x &= x - 1)
+    {
+        count++;
+    }
+    return count;
+}
+
+int lowestSetBit64(uint64_t x)
+{
+    int bit = 0;
+    for (; !(x & 1); x >>= 1)
+    {
+        bit++;
+    }
+    return bit;
+}
+#endif
+
+void setBankRange(VM *vm, unsigned int first, unsigned int count, int allocated)
+{
+    for (unsigned int bank = first; bank < first + count;) // one mask per bitmap word the range touches
     {
-        struct Node *current = head;
-        unsigned int uniqueAlocNum = 0;
-        for (int i = 0; i < NUM_BANKS; i++)
+        unsigned int bit = bank % 64;
+        unsigned int span = (count - (bank - first) < 64 - bit) ? count - (bank - first) : 64 - bit;
+        uint64_t mask = (span == 64) ? ~0ULL : ((1ULL << span) - 1) << bit;
+        if (allocated)
         {
-            if (current->next->startingAddress > value)
-            {
-                uniqueAlocNum = current->allocated;
-                break;
-            }
-            current = current->next;
+            vm->bankBitmap[bank / 64] |= mask;
         }
-        if (uniqueAlocNum)
+        else
         {
-            for (int j = 0; j < NUM_BANKS; j++)
-            {
-                if (current->allocated == uniqueAlocNum)
-                {
-                    current->allocated = 0;
-                    current = current->next;
-                }
-                else
-                {
-                    break;
-                }
-            }
+            vm->bankBitmap[bank / 64] &= ~mask;
         }
-        break;
-    }
-    default:
-        return 0;
+        bank += span;
     }
-    return 0;
 }
-unsigned int virtualReadCheck(unsigned int memAdress)
+
+unsigned int nextBank(const VM *vm, unsigned int bank, int allocated) // first bank from here on in that state, numBanks if none
 {
-    switch (memAdress)
+    unsigned int w = bank / 64;
+    uint64_t flip = allocated ? 0 : ~0ULL;
+    uint64_t bits = (vm->bankBitmap[w] ^ flip) & (~0ULL << (bank % 64));
+    while (bits == 0 && ++w < vm->bankWords) // whole words in the other state are skipped at once
     {
-    case 2066: // Console Read Character
+        bits = vm->bankBitmap[w] ^ flip;
+    }
+    if (bits == 0)
     {
-        char c;
-        scanf(" %c", &c);  // Added space before %c to avoid reading a newline
-        unsigned int castc = (unsigned int)c;
-        return castc;
+        return vm->numBanks;
     }
-    
-    case 2070: // Console Read Signed Integer
+    bank = w * 64 + lowestSetBit64(bits);
+    return bank < vm->numBanks ? bank : vm->numBanks;
+}
+
+int findFreeRun(const VM *vm, unsigned int banksRequired) // lowest bank starting banksRequired free banks, -1 when there is none
+{
+    if (banksRequired > 64) // long runs: walk free and allocated stretches a word at a time
+    {
+        for (unsigned int bank = nextBank(vm, 0, 0); bank + banksRequired <= vm->numBanks; bank = nextBank(vm, bank, 0))
+        {
+            unsigned int end = nextBank(vm, bank, 1);
+            if (end - bank >= banksRequired)
+            {
+                return (int)bank;
+            }
+            bank = end;
+        }
+        return -1;
+    }
+    for (unsigned int w = 0; w < vm->bankWords; w++)
     {
-        int d;
-        scanf("%d", &d);
-        unsigned int castd = (unsigned int)d;
-        return castd;
+        uint64_t runs = ~vm->bankBitmap[w];
+        uint64_t next = (w + 1 < vm->bankWords) ? ~vm->bankBitmap[w + 1] : 0; // a run starting in this word ends in the next at the latest
+        // after this loop bit i survives only if banks i .. i + banksRequired - 1 are all free, each step doubles the run length checked
+        for (unsigned int checked = 1; runs != 0 && checked < banksRequired;)
+        {
+            unsigned int shift = (checked < banksRequired - checked) ? checked : banksRequired - checked;
+            runs &= (runs >> shift) | (next << (64 - shift));
+            next &= next >> shift;
+            checked += shift;
+        }
+        if (runs != 0)
+        {
+            unsigned int bank = w * 64 + lowestSetBit64(runs);
+            return (bank + banksRequired <= vm->numBanks) ? (int)bank : -1;
+        }
     }
+    return -1;
+}
 
-    default:
+unsigned int heapAllocate(VM *vm, unsigned int size) // guest address of size fresh bytes, 0 if they do not fit
+{
+    unsigned int banksRequired = size / HEAP_SIZE + (size % HEAP_SIZE != 0); // no overflow near 4 GiB
+    int bank = (size == 0 || banksRequired > vm->numBanks) ? -1 : findFreeRun(vm, banksRequired);
+    if (bank < 0)
+    {
+        vm->heapStats.failedAllocations++;
         return 0;
     }
+    setBankRange(vm, bank, banksRequired, 1);
+    vm->allocationBanks[bank] = banksRequired;
+    vm->heapStats.usedBanks += banksRequired;
+    if (vm->heapStats.usedBanks > vm->heapStats.peakUsedBanks)
+    {
+        vm->heapStats.peakUsedBanks = vm->heapStats.usedBanks;
+    }
+    vm->heapStats.liveAllocations++;
+    vm->heapStats.totalAllocations++;
+    return vm->heapStart + bank * HEAP_SIZE;
 }
 
-void execute(Instruction instr, unsigned int rawInstruction)
+void heapFree(VM *vm, unsigned int address) // frees the allocation holding address from address's bank to its end
 {
-    switch (instr.opcode)
+    if (address < vm->heapStart || address >= vm->heapEnd)
     {
-    case 0b0110011: // Type: R (add, sub, xor, or, and, sll, srl, sra, slt, sltu)
-        switch (instr.func3)
-        {
-        case 0b000: // func3 000
-            switch (instr.func7)
-            {
-            case 0b0000000: // add
-                if (debugga)
-                {
-                    printf("add, pc = %d\n", pc);
-                }
-                if (instr.rd == 0)
-                {
-                    pc += 4;
-                    return;
-                }
-                regs[instr.rd] = regs[instr.rs1] + regs[instr.rs2];
-                pc += 4;
-                return;
-            case 0b0100000: // sub
-                if (debugga)
-                {
-                    printf("sub, pc = %d\n", pc);
-                }
-                if (instr.rd == 0)
-                {
-                    pc += 4;
-                    return;
-                }
-                regs[instr.rd] = regs[instr.rs1] - regs[instr.rs2];
-                pc += 4;
-                return;
-            default:
-                notImplemented(rawInstruction);
-                exit(1);
-            }
-        case 0b100: // xor func3 100
-            if (debugga)
-            {
-                printf("xor, pc = %d\n", pc);
-            }
-            if (instr.rd == 0)
-            {
-                pc += 4;
-                return;
-            }
-            regs[instr.rd] = regs[instr.rs1] ^ regs[instr.rs2];
-            pc += 4;
-            return;
-        case 0b110: // or func3 110
-            if (debugga)
-            {
-                printf("or, pc = %d\n", pc);
-            }
-            if (instr.rd == 0)
-            {
-                pc += 4;
-                return;
-            }
-            regs[instr.rd] = regs[instr.rs1] | regs[instr.rs2];
-            pc += 4;
-            return;
-        case 0b111: // and func3 111
-            if (debugga)
-            {
-                printf("and, pc = %d\n", pc);
-            }
-            if (instr.rd == 0)
-            {
-                pc += 4;
-                return;
-            }
-            regs[instr.rd] = regs[instr.rs1] & regs[instr.rs2];
-            pc += 4;
-            return;
-        case 0b001: // sll func3 001
-            if (debugga)
-            {
-                printf("sll, pc = %d\n", pc);
-            }
-            if (instr.rd == 0)
-            {
-                pc += 4;
-                return;
-            }
-            regs[instr.rd] = regs[instr.rs1] << regs[instr.rs2];
-            pc += 4;
-            return;
-        case 0b101: // func3 101
-            switch (instr.func7)
-            {
-            case 0b0000000: // srl
-                if (debugga)
-                {
-                    printf("srl, pc = %d\n", pc);
-                }
-                if (instr.rd == 0)
-                {
-                    pc += 4;
-                    return;
-                }
-                regs[instr.rd] = regs[instr.rs1] >> regs[instr.rs2];
-                pc += 4;
-                return;
-            case 0b0100000: // sra
-                if (debugga)
-                {
-                    printf("sra, pc = %d\n", pc);
-                }
-                if (instr.rd == 0)
-                {
-                    pc += 4;
-                    return;
-                }
-                regs[instr.rd] = regs[instr.rs1];
-                for (int i = 0; i < regs[instr.rs2]; i++)
-                {
-                    unsigned int lastBit = regs[instr.rd] & 0b1;      // extract the rightmost bit
-                    unsigned int shiftedLastBit = lastBit << 31;      // move it to the front (31 bits to the left)
-                    regs[instr.rd] = regs[instr.rd] >> 1;             // bitshift the target register
-                    regs[instr.rd] = regs[instr.rd] | shiftedLastBit; // place the shifted last bit in the front
-                }
-                pc += 4;
-                return;
-            default:
-                notImplemented(rawInstruction);
-                exit(1);
-            }
-        case 0b010: // slt func3 010
+        return;
+    }
+    unsigned int bank = (address - vm->heapStart) / HEAP_SIZE;
+    unsigned int first = bank;
+    if (vm->allocationBanks[bank] == 0) // not the address malloc returned, look for the allocation it lies in
+    {
+        if (!(vm->bankBitmap[bank / 64] >> (bank % 64) & 1))
         {
-            if (debugga)
-            {
-                printf("slt, pc = %d\n", pc);
-            }
-            if (instr.rd == 0)
-            {
-                pc += 4;
-                return;
-            }
-            int rs1 = (int)regs[instr.rs1]; // to treat as signed
-            int rs2 = (int)regs[instr.rs2];
-            regs[instr.rd] = (rs1 < rs2) ? 1 : 0;
-            pc += 4;
             return;
         }
-        case 0b011: // sltu func3 011
+        while (vm->allocationBanks[first] == 0) // the nearest bank below with a length starts it
         {
-            if (debugga)
-            {
-                printf("sltu, pc = %d\n", pc);
-            }
-            if (instr.rd == 0)
-            {
-                pc += 4;
-                return;
-            }
-            regs[instr.rd] = (regs[instr.rs1] < regs[instr.rs2]) ? 1 : 0; // registers store unsigned data, so this should already be treated as such
-            pc += 4;
-            return;
+            first--;
         }
-        default:
-            notImplemented(rawInstruction);
-            exit(1);
+    }
+    unsigned int banks = first + vm->allocationBanks[first] - bank;
+    setBankRange(vm, bank, banks, 0);
+    vm->allocationBanks[first] = bank - first; // freeing from inside keeps the banks before it allocated
+    vm->heapStats.usedBanks -= banks;
+    if (bank == first)
+    {
+        vm->heapStats.liveAllocations--;
+    }
+}
+
+HeapStats vmHeapStatistics(const VM *vm)
+{
+    HeapStats stats = vm->heapStats;
+    unsigned int used = 0;
+    for (unsigned int w = 0; w < vm->bankWords; w++)
+    {
+        used += bitCount64(vm->bankBitmap[w]);
+    }
+    stats.usedBanks = used;
+    stats.freeBanks = vm->numBanks - used;
+    stats.largestFreeRun = 0;
+    unsigned int run = 0;
+    for (unsigned int bank = 0; bank < vm->numBanks; bank++)
+    {
+        run = (vm->bankBitmap[bank / 64] >> (bank % 64) & 1) ? 0 : run + 1;
+        if (run > stats.largestFreeRun)
+        {
+            stats.largestFreeRun = run;
         }
-    case 0b0010011: // Type: I (addi, xori, ori, andi, slti, sltiu)
-        switch (instr.func3)
+    }
+    return stats;
+}
+
+void vmPrintHeapStatistics(const VM *vm, FILE *output)
+{
+    HeapStats stats = vmHeapStatistics(vm);
+    double fragmentation = stats.freeBanks ? 1.0 - (double)stats.largestFreeRun / stats.freeBanks : 0.0;
+    fprintf(output, "heap: %u/%u banks used, peak %u, largest free run %u, fragmentation %.2f\n",
+            stats.usedBanks, vm->numBanks, stats.peakUsedBanks, stats.largestFreeRun, fragmentation);
+    fprintf(output, "heap: %u live allocations, %u total, %u failed\n",
+            stats.liveAllocations, stats.totalAllocations, stats.failedAllocations);
+}
+
+// Host memory behind length bytes of guest memory from address on, NULL unless the whole range sits in one
+// region: the heap, or data memory (instruction memory too when reading, it comes right before data memory in
+// the arena). Ranges touching the device page are refused.
+unsigned char *guestRange(VM *vm, unsigned int address, unsigned int length, int write)
+{
+    unsigned int last = address + length - 1;
+    if (length == 0 || last < address || (address < DEVICE_START + PAGE_SIZE && last >= DEVICE_START))
+    {
+        return NULL;
+    }
+    if (address >= vm->heapStart && last < vm->heapEnd)
+    {
+        return vm->heapMemory + (address - vm->heapStart);
+    }
+    if (address >= (write ? (unsigned int)vm->instSize : 0) && last < (unsigned int)(vm->instSize + vm->dataSize))
+    {
+        return vm->instMemory + address;
+    }
+    return NULL;
+}
+
+int dmaCommand(VM *vm, unsigned int command) // 0 for an unknown command or a range outside memory, the store is then illegal
+{
+    if (vm->dmaLength == 0)
+    {
+        return command == DMA_COPY || command == DMA_FILL;
+    }
+    unsigned char *target = guestRange(vm, vm->dmaDestination, vm->dmaLength, 1);
+    if (command == DMA_COPY)
+    {
+        unsigned char *source = guestRange(vm, vm->dmaSource, vm->dmaLength, 0);
+        if (target == NULL || source == NULL)
         {
-        case 0b000: // addi
-            if (debugga)
-            {
-                printf("addi, pc = %d\n", pc);
-            }
-            if (instr.rd == 0)
-            {
-                pc += 4;
-                return;
-            }
-            regs[instr.rd] = regs[instr.rs1] + instr.immI;
-            pc += 4;
-            return;
-        case 0b100: // xori
-            if (debugga)
-            {
-                printf("xori, pc = %d\n", pc);
-            }
-            if (instr.rd == 0)
-            {
-                pc += 4;
-                return;
-            }
-            regs[instr.rd] = regs[instr.rs1] ^ instr.immI;
-            pc += 4;
-            return;
-        case 0b110: // ori
-            if (debugga)
-            {
-                printf("ori, pc = %d\n", pc);
-            }
-            if (instr.rd == 0)
-            {
-                pc += 4;
-                return;
-            }
-            regs[instr.rd] = regs[instr.rs1] | instr.immI;
-            pc += 4;
-            return;
-        case 0b111: // andi
-            if (debugga)
-            {
-                printf("andi, pc = %d\n", pc);
-            }
-            if (instr.rd == 0)
+            return 0;
+        }
+        memmove(target, source, vm->dmaLength); // overlapping ranges copy as if through a temporary buffer
+        return 1;
+    }
+    if (command == DMA_FILL && target != NULL)
+    {
+        memset(target, vm->dmaSource & 0xff, vm->dmaLength); // the source register holds the fill byte
+        return 1;
+    }
+    return 0;
+}
+
+int virtualWriteCheck(VM *vm, unsigned int memAdress, unsigned int value)
+{
+    switch (memAdress)
+    {
+    case 2048: // Console Write Character
+    {
+        char c = value;
+        consoleWrite(vm, &c, 1);
+        return 1;
+    }
+    case 2052: // Console Write Signed Integer
+        consolePrintf(vm, "%d", value);
+        return 1;
+    case 2056: // Console Write Unsigned Integer
+        consolePrintf(vm, "%x", value);
+        return 1;
+    case 2060: // HALT
+        consolePrintf(vm, "CPU Halt Requested\n");
+        vm->status = VM_HALTED;
+        return 1;
+    case 2080: // Dump PC
+        consolePrintf(vm, "%x\n", vm->pc);
+        return 1;
+    case 2084: // Dump Register Banks
+        dumpRegisters(vm);
+        return 1;
+    case 2088: // Dump Memory Word
+    {
+        unsigned char *source = loadAddress(vm, value, 4);
+        if (source != NULL)
+        {
+            consolePrintf(vm, "%x\n", load32(source));
+        }
+        return 1;
+    }
+    case 2096: // malloc
+        vm->regs[28] = heapAllocate(vm, value);
+        return 1;
+    case 2100: // free
+        heapFree(vm, value);
+        return 1;
+    case VM_SNAPSHOT_DEVICE: // snapshot point, ignored unless the host asked for it
+        if (vm->snapshotTrigger)
+        {
+            vm->status = VM_SNAPSHOT_POINT;
+        }
+        return 1;
+    case 2112: // DMA source address, or the fill byte
+        vm->dmaSource = value;
+        return 1;
+    case 2116: // DMA destination address
+        vm->dmaDestination = value;
+        return 1;
+    case 2120: // DMA length in bytes
+        vm->dmaLength = value;
+        return 1;
+    case 2124: // DMA command
+        return dmaCommand(vm, value);
+    case 2128: // Console Write Block, start address
+        vm->writePointer = value;
+        return 1;
+    case 2132: // Console Write Block, length: writes that many bytes from the start address in one go
+    {
+        const unsigned char *source = guestRange(vm, vm->writePointer, value, 0);
+        if (source != NULL)
+        {
+            consoleWrite(vm, (const char *)source, value);
+        }
+        return source != NULL || value == 0;
+    }
+    default:
+        return 0;
+    }
+    return 0;
+}
+int fillInput(VM *vm) // read the next chunk of console input: 1 got data, 0 end of input, -1 nothing there yet
+{
+    if (vm->inputEof)
+    {
+        return 0;
+    }
+    if (vm->inputStart > 0) // move the unparsed tail to the front to make room
+    {
+        memmove(vm->inputBuffer, vm->inputBuffer + vm->inputStart, vm->inputEnd - vm->inputStart);
+        vm->inputEnd -= vm->inputStart;
+        vm->inputStart = 0;
+    }
+    if (vm->inputEnd == vm->inputCapacity) // one token fills the whole buffer, treat it as complete
+    {
+        return 0;
+    }
+    ssize_t got;
+    if (vm->inputFd < 0)
+    {
+        got = fread(vm->inputBuffer + vm->inputEnd, 1, vm->inputCapacity - vm->inputEnd, vm->input);
+        got = (got == 0 && ferror(vm->input)) ? -1 : got;
+    }
+    else
+    {
+        if (vm->inputNonBlocking)
+        {
+            struct pollfd ready = {vm->inputFd, POLLIN, 0};
+            if (poll(&ready, 1, 0) == 0)
             {
-                pc += 4;
-                return;
+                return -1;
             }
-            regs[instr.rd] = regs[instr.rs1] & instr.immI;
-            pc += 4;
-            return;
-        case 0b010: // slti
-            if (debugga)
+        }
+        do
+        {
+            got = read(vm->inputFd, vm->inputBuffer + vm->inputEnd, vm->inputCapacity - vm->inputEnd);
+        } while (got < 0 && errno == EINTR);
+    }
+    if (got <= 0)
+    {
+        vm->inputEof = 1;
+        return 0;
+    }
+    vm->inputEnd += got;
+    return 1;
+}
+
+int readConsoleChar(VM *vm, unsigned int *value) // like scanf(" %c"): 1 read, -1 would block
+{
+    for (;;)
+    {
+        while (vm->inputStart < vm->inputEnd && isspace(vm->inputBuffer[vm->inputStart])) // the space before %c skips newlines
+        {
+            vm->inputStart++;
+        }
+        if (vm->inputStart < vm->inputEnd)
+        {
+            char c = vm->inputBuffer[vm->inputStart++];
+            *value = (unsigned int)c;
+            return 1;
+        }
+        int filled = fillInput(vm);
+        if (filled < 0)
+        {
+            return -1;
+        }
+        if (filled == 0)
+        {
+            *value = (unsigned int)EOF;
+            return 1;
+        }
+    }
+}
+
+int readConsoleInt(VM *vm, unsigned int *value) // like scanf("%d"): 1 read (0 when there is no number), -1 would block
+{
+    for (;;)
+    {
+        size_t at = vm->inputStart;
+        while (at < vm->inputEnd && isspace(vm->inputBuffer[at]))
+        {
+            at++;
+        }
+        size_t digits = at < vm->inputEnd && (vm->inputBuffer[at] == '-' || vm->inputBuffer[at] == '+') ? at + 1 : at;
+        size_t end = digits;
+        while (end < vm->inputEnd && isdigit(vm->inputBuffer[end]))
+        {
+            end++;
+        }
+        if (end == vm->inputEnd && !vm->inputEof) // the number may carry on in the next chunk
+        {
+            int filled = fillInput(vm);
+            if (filled < 0)
             {
-                printf("slti, pc = %d\n", pc);
+                return -1;
             }
-            if (instr.rd == 0)
+            if (filled > 0 || vm->inputEnd < vm->inputCapacity)
             {
-                pc += 4;
-                return;
+                continue;
             }
-            regs[instr.rd] = (regs[instr.rs1] < instr.immI) ? 1 : 0;
-            pc += 4;
-            return;
-        case 0b011: // sltiu
-            if (debugga)
+        }
+        vm->inputStart = at;
+        if (end == digits) // no digits: nothing is consumed past the whitespace, as with scanf
+        {
+            *value = 0;
+            return 1;
+        }
+        unsigned int number = 0;
+        for (size_t i = digits; i < end; i++)
+        {
+            number = number * 10 + (vm->inputBuffer[i] - '0');
+        }
+        *value = (vm->inputBuffer[at] == '-') ? 0u - number : number;
+        vm->inputStart = end;
+        return 1;
+    }
+}
+
+int virtualReadCheck(VM *vm, unsigned int memAdress, int *value) // 0 when the guest has to wait for input
+{
+    if (vm->flushPolicy & VM_FLUSH_INPUT) // a prompt written before the read has to be visible first
+    {
+        vmFlushOutput(vm);
+    }
+    unsigned int read = 0;
+    int result = 1;
+    switch (memAdress)
+    {
+    case 2066: // Console Read Character
+        result = readConsoleChar(vm, &read);
+        break;
+    case 2070: // Console Read Signed Integer
+        result = readConsoleInt(vm, &read);
+        break;
+    default:
+        break;
+    }
+    if (result < 0) // park: pc stays on the load so it runs again when vmRun is called after input arrives
+    {
+        vm->status = VM_WAITING_INPUT;
+        vm->instructionsExecuted--; // the retry counts as the one execution
+        return 0;
+    }
+    *value = read;
+    return 1;
+}
+
+void deviceLoad(VM *vm, const DecodedOp *op, unsigned int address) // a load that missed memory
+{
+    if (devicePage(vm, address) && (address == 2066 || address == 2070))
+    {
+        if (virtualReadCheck(vm, address, &vm->regs[op->rd]))
+        {
+            vm->pc += opLength(op);
+            if (vm->profile != NULL) // a parked read is counted when it is retried
             {
-                printf("sltiu, pc = %d\n", pc);
+                vm->profile->deviceLoads[address - DEVICE_START]++;
             }
-            if (instr.rd == 0)
+        }
+        return;
+    }
+    illegalOperation(vm);
+}
+
+void deviceStore(VM *vm, const DecodedOp *op, unsigned int address, unsigned int value) // a store that missed memory
+{
+    if (devicePage(vm, address) && virtualWriteCheck(vm, address, value))
+    {
+        vm->pc += opLength(op);
+        if (vm->profile != NULL)
+        {
+            vm->profile->deviceStores[address - DEVICE_START]++;
+        }
+        return;
+    }
+    illegalOperation(vm);
+}
+
+int signExtend(unsigned int value, int bits)
+{
+    unsigned int sign = 1u << (bits - 1);
+    return (int)((value ^ sign) - sign);
+}
+
+// RVC: every 16-bit encoding is expanded to the base instruction it stands for, so the engines only see
+// the compressed flag. Encodings whose expansion the VM does not implement either (the immediate shifts,
+// floating point, ebreak) and the reserved ones, the all-zero halfword included, are not implemented.
+DecodedOp decodeCompressed(unsigned int half)
+{
+    DecodedOp op = {OP_NOT_IMPLEMENTED, 1, 0, 0, 0, 0};
+    unsigned int func3 = half >> 13;
+    unsigned int bit12 = (half >> 12) & 0b1;
+    unsigned int full = (half >> 7) & 0b11111;        // rd / rs1
+    unsigned int fullRs2 = (half >> 2) & 0b11111;
+    unsigned int prime = 8 + ((half >> 7) & 0b111);   // rd' / rs1', x8 .. x15
+    unsigned int primeRs2 = 8 + ((half >> 2) & 0b111);
+    int imm6 = signExtend(bit12 << 5 | fullRs2, 6); // c.addi, c.li, c.andi
+    unsigned int wordOffset = ((half >> 10) & 0b111) << 3 | ((half >> 6) & 0b1) << 2 | ((half >> 5) & 0b1) << 6; // c.lw, c.sw
+    int jumpOffset = signExtend(bit12 << 11 | ((half >> 11) & 0b1) << 4 | ((half >> 9) & 0b11) << 8 | ((half >> 8) & 0b1) << 10 |
+                                    ((half >> 7) & 0b1) << 6 | ((half >> 6) & 0b1) << 7 | ((half >> 3) & 0b111) << 1 | ((half >> 2) & 0b1) << 5,
+                                12); // c.j, c.jal
+    int branchOffset = signExtend(bit12 << 8 | ((half >> 10) & 0b11) << 3 | ((half >> 5) & 0b11) << 6 | ((half >> 3) & 0b11) << 1 |
+                                      ((half >> 2) & 0b1) << 5,
+                                  9); // c.beqz, c.bnez
+
+    switch ((half & 0b11) << 3 | func3)
+    {
+    case 0b00000: // c.addi4spn: addi rd', x2, nzuimm
+    {
+        unsigned int imm = ((half >> 11) & 0b11) << 4 | ((half >> 7) & 0b1111) << 6 | ((half >> 6) & 0b1) << 2 | ((half >> 5) & 0b1) << 3;
+        if (imm != 0)
+        {
+            op = (DecodedOp){OP_ADDI, 1, primeRs2, 2, 0, imm};
+        }
+        return op;
+    }
+    case 0b00010: // c.lw: lw rd', offset(rs1')
+        return (DecodedOp){OP_LW, 1, primeRs2, prime, 0, wordOffset};
+    case 0b00110: // c.sw: sw rs2', offset(rs1')
+        return (DecodedOp){OP_SW, 1, 0, prime, primeRs2, wordOffset};
+    case 0b01000: // c.addi (c.nop with rd = x0): addi rd, rd, imm
+        return (DecodedOp){OP_ADDI, 1, full, full, 0, imm6};
+    case 0b01001: // c.jal: jal x1, offset
+        return (DecodedOp){OP_JAL, 1, 1, 0, 0, jumpOffset};
+    case 0b01010: // c.li: addi rd, x0, imm
+        return (DecodedOp){OP_ADDI, 1, full, 0, 0, imm6};
+    case 0b01011:
+        if (full == 2) // c.addi16sp: addi x2, x2, nzimm
+        {
+            int imm = signExtend(bit12 << 9 | ((half >> 6) & 0b1) << 4 | ((half >> 5) & 0b1) << 6 | ((half >> 3) & 0b11) << 7 | ((half >> 2) & 0b1) << 5, 10);
+            if (imm != 0)
             {
-                pc += 4;
-                return;
+                op = (DecodedOp){OP_ADDI, 1, 2, 2, 0, imm};
             }
-            unsigned int unsignedImmI = (unsigned int)instr.immI; // cast to treat the imm as unsigned
-            regs[instr.rd] = (regs[instr.rs1] < unsignedImmI) ? 1 : 0;
-            pc += 4;
-            return;
-        default:
-            notImplemented(rawInstruction);
-            exit(1);
         }
-    case 0b0000011: // Type: I (lb, lh, lw, lbu, lhu)
-        switch (instr.func3)
+        else if (imm6 != 0) // c.lui: lui rd, nzimm
+        {
+            op = (DecodedOp){OP_LUI, 1, full, 0, 0, (int)((unsigned int)imm6 << 12)};
+        }
+        return op;
+    case 0b01100:
+    {
+        static const uint8_t arithmeticOps[4] = {OP_SUB, OP_XOR, OP_OR, OP_AND};
+        unsigned int func2 = (half >> 10) & 0b11;
+        if (func2 == 0b10) // c.andi: andi rd', rd', imm
+        {
+            op = (DecodedOp){OP_ANDI, 1, prime, prime, 0, imm6};
+        }
+        else if (func2 == 0b11 && bit12 == 0) // c.sub, c.xor, c.or, c.and: op rd', rd', rs2'
+        {
+            op = (DecodedOp){arithmeticOps[(half >> 5) & 0b11], 1, prime, prime, primeRs2, 0};
+        }
+        return op; // c.srli and c.srai have no base instruction here
+    }
+    case 0b01101: // c.j: jal x0, offset
+        return (DecodedOp){OP_JAL, 1, 0, 0, 0, jumpOffset};
+    case 0b01110: // c.beqz: beq rs1', x0, offset
+        return (DecodedOp){OP_BEQ, 1, 0, prime, 0, branchOffset};
+    case 0b01111: // c.bnez: bne rs1', x0, offset
+        return (DecodedOp){OP_BNE, 1, 0, prime, 0, branchOffset};
+    case 0b10010: // c.lwsp: lw rd, offset(x2)
+        if (full != 0)
+        {
+            op = (DecodedOp){OP_LW, 1, full, 2, 0, bit12 << 5 | ((half >> 4) & 0b111) << 2 | ((half >> 2) & 0b11) << 6};
+        }
+        return op;
+    case 0b10100:
+        if (fullRs2 != 0) // c.mv: add rd, x0, rs2 / c.add: add rd, rd, rs2
+        {
+            op = (DecodedOp){OP_ADD, 1, full, bit12 ? full : 0, fullRs2, 0};
+        }
+        else if (full != 0) // c.jr: jalr x0, 0(rs1) / c.jalr: jalr x1, 0(rs1)
+        {
+            op = (DecodedOp){OP_JALR, 1, bit12, full, 0, 0};
+        }
+        return op; // c.ebreak
+    case 0b10110: // c.swsp: sw rs2, offset(x2)
+        return (DecodedOp){OP_SW, 1, 0, 2, fullRs2, ((half >> 9) & 0b1111) << 2 | ((half >> 7) & 0b11) << 6};
+    default: // c.slli and the floating-point loads and stores
+        return op;
+    }
+}
+
+DecodedOp decodeInstruction(unsigned int raw)
+{
+    DecodedOp op;
+    Immediate unsignedImm;
+    unsigned int opcode = raw & 0b1111111;
+    unsigned int func3 = (raw >> 12) & 0b111;
+    unsigned int func7 = raw >> 25;
+
+    if ((raw & 0b11) != 0b11) // the low two bits of every 4-byte encoding are set
+    {
+        return decodeCompressed(raw & 0xFFFF);
+    }
+    op.handler = OP_NOT_IMPLEMENTED;
+    op.compressed = 0;
+    op.rd = (raw >> 7) & 0b11111;
+    op.rs1 = (raw >> 15) & 0b11111;
+    op.rs2 = (raw >> 20) & 0b11111;
+    op.imm = 0;
+
+    switch (opcode)
+    {
+    case 0b0110011: // Type: R (add, sub, xor, or, and, sll, srl, sra, slt, sltu, and the RV32M ops)
+    {
+        static const uint8_t rOps[8] = {OP_ADD, OP_SLL, OP_SLT, OP_SLTU, OP_XOR, OP_SRL, OP_OR, OP_AND};
+        static const uint8_t mOps[8] = {OP_MUL, OP_MULH, OP_MULHSU, OP_MULHU, OP_DIV, OP_DIVU, OP_REM, OP_REMU};
+        if (func7 == 0b0000000)
+        {
+            op.handler = rOps[func3];
+        }
+        else if (func7 == 0b0000001)
+        {
+            op.handler = mOps[func3];
+        }
+        else if (func7 == 0b0100000 && (func3 == 0b000 || func3 == 0b101))
+        {
+            op.handler = (func3 == 0b000) ? OP_SUB : OP_SRA;
+        }
+        return op;
+    }
+    case 0b0010011: // Type: I (addi, xori, ori, andi, slti, sltiu)
+    case 0b0000011: // Type: I (lb, lh, lw, lbu, lhu)
+    case 0b1100111: // Type: I (jalr)
+    {
+        static const uint8_t aluOps[8] = {OP_ADDI, OP_NOT_IMPLEMENTED, OP_SLTI, OP_SLTIU, OP_XORI, OP_NOT_IMPLEMENTED, OP_ORI, OP_ANDI};
+        static const uint8_t loadOps[8] = {OP_LB, OP_LH, OP_LW, OP_NOT_IMPLEMENTED, OP_LBU, OP_LHU, OP_NOT_IMPLEMENTED, OP_NOT_IMPLEMENTED};
+        if (opcode == 0b0010011)
+        {
+            op.handler = aluOps[func3];
+        }
+        else if (opcode == 0b0000011)
+        {
+            op.handler = loadOps[func3];
+        }
+        else
+        {
+            op.handler = OP_JALR;
+        }
+        unsignedImm.u = raw >> 20;
+        if (unsignedImm.u & 0x800)
+        {
+            unsignedImm.u |= 0xFFFFF000;
+        }
+        op.imm = unsignedImm.s;
+        return op;
+    }
+    case 0b0100011: // Type: S (sb, sh, sw)
+    {
+        static const uint8_t storeOps[8] = {OP_SB, OP_SH, OP_SW, OP_NOT_IMPLEMENTED, OP_NOT_IMPLEMENTED, OP_NOT_IMPLEMENTED, OP_NOT_IMPLEMENTED, OP_NOT_IMPLEMENTED};
+        op.handler = storeOps[func3];
+        unsignedImm.u = ((raw >> 7) & 0b11111) | ((raw >> 25) << 5);
+        if (unsignedImm.u & 0x800)
+        {
+            unsignedImm.u |= 0xFFFFF000;
+        }
+        op.imm = unsignedImm.s;
+        return op;
+    }
+    case 0b1100011: // Type: SB (beq, bne, blt, bltu, bge, bgeu)
+    {
+        static const uint8_t branchOps[8] = {OP_BEQ, OP_BNE, OP_NOT_IMPLEMENTED, OP_NOT_IMPLEMENTED, OP_BLT, OP_BGE, OP_BLTU, OP_BGEU};
+        op.handler = branchOps[func3];
+        unsignedImm.u = (((raw >> 7) & 0b1) << 11) | (((raw >> 8) & 0b1111) << 1) | (((raw >> 25) & 0b111111) << 5) | ((raw >> 31) << 12);
+        if (unsignedImm.u & 0x1000)
+        {
+            unsignedImm.u |= 0xFFFFE000;
+        }
+        op.imm = unsignedImm.s;
+        return op;
+    }
+    case 0b0110111: // Type: U (lui)
+        op.handler = OP_LUI;
+        unsignedImm.u = raw & 0xFFFFF000;
+        op.imm = unsignedImm.s;
+        return op;
+    case 0b1101111: // Type: UJ (jal)
+        op.handler = OP_JAL;
+        unsignedImm.u = ((raw >> 31) << 20) | (((raw >> 12) & 0b11111111) << 12) | (((raw >> 20) & 0b1) << 11) | (((raw >> 21) & 0b1111111111) << 1);
+        if (unsignedImm.u & 0x100000)
+        {
+            unsignedImm.u |= 0xFFE00000;
+        }
+        op.imm = unsignedImm.s;
+        return op;
+    default:
+        return op;
+    }
+}
+
+void disassemble(const VM *vm, int pc, char *text, size_t size) // one instruction as written, compressed ones expanded, branch targets as absolute addresses
+{
+    DecodedOp op = decodeInstruction(rawInstructionAt(vm, pc)); // undoes far branches and fusion
+    const char *name = opNames[op.handler];
+    if (op.handler <= OP_SLTU)
+    {
+        snprintf(text, size, "%s x%d, x%d, x%d", name, op.rd, op.rs1, op.rs2);
+    }
+    else if (op.handler <= OP_SLTIU)
+    {
+        snprintf(text, size, "%s x%d, x%d, %d", name, op.rd, op.rs1, op.imm);
+    }
+    else if (op.handler <= OP_JALR)
+    {
+        snprintf(text, size, "%s x%d, %d(x%d)", name, op.rd, op.imm, op.rs1);
+    }
+    else if (op.handler <= OP_SW)
+    {
+        snprintf(text, size, "%s x%d, %d(x%d)", name, op.rs2, op.imm, op.rs1);
+    }
+    else if (op.handler <= OP_BGEU)
+    {
+        snprintf(text, size, "%s x%d, x%d, 0x%03x", name, op.rs1, op.rs2, pc + op.imm);
+    }
+    else if (op.handler == OP_LUI)
+    {
+        snprintf(text, size, "lui x%d, 0x%05x", op.rd, ((unsigned int)op.imm >> 12));
+    }
+    else if (op.handler == OP_JAL)
+    {
+        snprintf(text, size, "jal x%d, 0x%03x", op.rd, pc + op.imm);
+    }
+    else if (op.handler >= OP_MUL && op.handler <= OP_REMU)
+    {
+        snprintf(text, size, "%s x%d, x%d, x%d", name, op.rd, op.rs1, op.rs2);
+    }
+    else
+    {
+        snprintf(text, size, op.compressed ? ".half 0x%04x" : ".word 0x%08x", rawInstructionAt(vm, pc));
+    }
+}
+
+int branchTaken(int handler, int rs1, int rs2) // condition of a branch or jal, compared the way execute() does
+{
+    switch (handler)
+    {
+    case OP_BEQ:
+        return rs1 == rs2;
+    case OP_BNE:
+        return rs1 != rs2;
+    case OP_BLT:
+    case OP_BLTU:
+        return rs1 < rs2;
+    case OP_BGE:
+    case OP_BGEU:
+        return rs1 >= rs2;
+    default:
+        return 1;
+    }
+}
+
+// Every direct branch and jal target is known once the image is decoded, so it is checked here once:
+// targets inside instruction memory and 2-byte aligned keep their handlers, which no longer check
+// anything at run time, and the rest become OP_FAR_BRANCH, an illegal operation if it is ever taken.
+// Only jalr still checks its target while running.
+void checkBranchTargets(VM *vm)
+{
+    for (int i = 0; i < vm->numSlots; i++)
+    {
+        DecodedOp *op = &vm->decodedOps[i];
+        int target = i * 2 + op->imm;
+        if (((op->handler >= OP_BEQ && op->handler <= OP_BGEU) || op->handler == OP_JAL) &&
+            (target < 0 || target > vm->instSize - 2 || (target & 1)))
+        {
+            op->rd = op->handler;
+            op->handler = OP_FAR_BRANCH;
+        }
+    }
+}
+
+// Marks every slot where a fusion rule matches. Only the slot of the first instruction changes, the
+// others keep their own handlers, so a jump into the middle of an idiom still runs it instruction by
+// instruction and no basic block boundaries have to be respected. No rule has a control transfer
+// before its last instruction. Idioms are looked for along the instructions a linear sweep from the
+// start of the image finds, and only 4-byte instructions take part, so fused handlers step pc by 4.
+void fuseOps(VM *vm)
+{
+    memset(vm->fusedOps, FUSE_NONE, vm->numSlots + 1);
+    vm->fusionStats.sites = 0;
+    vm->fusionStats.instructions = 0;
+    for (int i = 0; i < vm->numSlots; i += opLength(&vm->decodedOps[i]) / 2)
+    {
+        for (int rule = FUSE_NONE + 1; rule < NUM_FUSED_OPS; rule++)
+        {
+            const FusionRule *fusion = &fusionRules[rule];
+            int length = fusion->length;
+            DecodedOp ops[3]; // the idiom's instructions in program order
+            int matched = 1;
+            int slot = i;
+            for (int k = 0; matched && k < length; k++)
+            {
+                matched = slot < vm->numSlots && vm->decodedOps[slot].handler == fusion->handlers[k] && !vm->decodedOps[slot].compressed;
+                ops[k] = vm->decodedOps[slot]; // the sentinel at worst
+                slot += 2;
+            }
+            if (matched && (fusion->matches == NULL || fusion->matches(ops)))
+            {
+                vm->fusedOps[i] = rule;
+                vm->fusionStats.sites++;
+                vm->fusionStats.instructions += length;
+                break;
+            }
+        }
+    }
+}
+
+void aotRelease(VM *vm) // drop the native code translated from the previous image
+{
+#if AOT_SUPPORT
+    if (vm->aotHandle != NULL)
+    {
+        dlclose(vm->aotHandle);
+    }
+#endif
+    vm->aotHandle = NULL;
+    vm->aotRun = NULL;
+    vm->aotTried = 0;
+}
+
+void predecode(VM *vm)
+{
+    int slots = vm->numSlots;
+    for (int i = 0; i < slots; i++)
+    {
+        vm->decodedOps[i] = decodeInstruction(rawInstructionAt(vm, i * 2));
+    }
+    if (!vm->decodedOps[slots - 1].compressed) // a 4-byte instruction in the last halfword would run off the end
+    {
+        vm->decodedOps[slots - 1] = (DecodedOp){OP_END_OF_PROGRAM, 1, 0, 0, 0, 0};
+    }
+    vm->decodedOps[slots] = (DecodedOp){OP_END_OF_PROGRAM, 0, 0, 0, 0, 0};
+    vm->threadedReady = 0;
+    if (vm->profile != NULL) // counts belong to the image they were taken on
+    {
+        memset(vm->profile, 0, sizeof(Profile) + 2 * slots * sizeof(uint64_t));
+        vm->profile->executed = vm->profile->slots;
+        vm->profile->taken = vm->profile->slots + slots;
+    }
+    checkBranchTargets(vm);
+    fuseOps(vm);
+    memset(vm->jitBlocks, 0, slots * sizeof(JitBlock)); // compiled code belongs to the old image
+    memset(vm->jitCounts, 0, slots * sizeof(uint16_t));
+    vm->jitUsed = 0;
+    vm->jitStats = (JitStats){0};
+    aotRelease(vm);
+}
+
+// RV32M. Division never traps: by zero it gives all ones and a remainder of the dividend, and INT_MIN / -1
+// overflows to INT_MIN with a remainder of 0, as the spec requires.
+static inline int multiplyDivide(int handler, int a, int b)
+{
+    switch (handler)
+    {
+    case OP_MUL:
+        return (int)((uint32_t)a * (uint32_t)b);
+    case OP_MULH:
+        return (int)(((int64_t)a * b) >> 32);
+    case OP_MULHSU:
+        return (int)(((int64_t)a * (int64_t)(uint32_t)b) >> 32);
+    case OP_MULHU:
+        return (int)(((uint64_t)(uint32_t)a * (uint32_t)b) >> 32);
+    case OP_DIV:
+        return b == 0 ? -1 : (a == INT32_MIN && b == -1) ? a : a / b;
+    case OP_DIVU:
+        return b == 0 ? -1 : (int)((uint32_t)a / (uint32_t)b);
+    case OP_REM:
+        return b == 0 ? a : (a == INT32_MIN && b == -1) ? 0 : a % b;
+    default: // OP_REMU
+        return b == 0 ? a : (int)((uint32_t)a % (uint32_t)b);
+    }
+}
+
+// Instantiated once per instruction length: with the length a constant, pc does not depend on a value
+// loaded from the op, which would lengthen the chain from one instruction to the next.
+static ALWAYS_INLINE void executeSized(VM *vm, const DecodedOp *op, int length)
+{
+    int *regs = vm->regs;
+    switch (op->handler)
+    {
+    case OP_ADD:
+        if (op->rd == 0)
+        {
+            vm->pc += length;
+            return;
+        }
+        regs[op->rd] = regs[op->rs1] + regs[op->rs2];
+        vm->pc += length;
+        return;
+    case OP_SUB:
+        if (op->rd == 0)
+        {
+            vm->pc += length;
+            return;
+        }
+        regs[op->rd] = regs[op->rs1] - regs[op->rs2];
+        vm->pc += length;
+        return;
+    case OP_XOR:
+        if (op->rd == 0)
+        {
+            vm->pc += length;
+            return;
+        }
+        regs[op->rd] = regs[op->rs1] ^ regs[op->rs2];
+        vm->pc += length;
+        return;
+    case OP_OR:
+        if (op->rd == 0)
+        {
+            vm->pc += length;
+            return;
+        }
+        regs[op->rd] = regs[op->rs1] | regs[op->rs2];
+        vm->pc += length;
+        return;
+    case OP_AND:
+        if (op->rd == 0)
+        {
+            vm->pc += length;
+            return;
+        }
+        regs[op->rd] = regs[op->rs1] & regs[op->rs2];
+        vm->pc += length;
+        return;
+    case OP_SLL:
+        if (op->rd == 0)
+        {
+            vm->pc += length;
+            return;
+        }
+        regs[op->rd] = regs[op->rs1] << regs[op->rs2];
+        vm->pc += length;
+        return;
+    case OP_SRL:
+        if (op->rd == 0)
+        {
+            vm->pc += length;
+            return;
+        }
+        regs[op->rd] = regs[op->rs1] >> regs[op->rs2];
+        vm->pc += length;
+        return;
+    case OP_SRA:
+        if (op->rd == 0)
+        {
+            vm->pc += length;
+            return;
+        }
+        regs[op->rd] = regs[op->rs1];
+        for (int i = 0; i < regs[op->rs2]; i++)
+        {
+            unsigned int lastBit = regs[op->rd] & 0b1;      // extract the rightmost bit
+            unsigned int shiftedLastBit = lastBit << 31;    // move it to the front (31 bits to the left)
+            regs[op->rd] = regs[op->rd] >> 1;               // bitshift the target register
+            regs[op->rd] = regs[op->rd] | shiftedLastBit;   // place the shifted last bit in the front
+        }
+        vm->pc += length;
+        return;
+    case OP_SLT:
+    {
+        if (op->rd == 0)
+        {
+            vm->pc += length;
+            return;
+        }
+        int rs1 = (int)regs[op->rs1]; // to treat as signed
+        int rs2 = (int)regs[op->rs2];
+        regs[op->rd] = (rs1 < rs2) ? 1 : 0;
+        vm->pc += length;
+        return;
+    }
+    case OP_SLTU:
+        if (op->rd == 0)
+        {
+            vm->pc += length;
+            return;
+        }
+        regs[op->rd] = (regs[op->rs1] < regs[op->rs2]) ? 1 : 0; // registers store unsigned data, so this should already be treated as such
+        vm->pc += length;
+        return;
+    case OP_ADDI:
+        if (op->rd == 0)
+        {
+            vm->pc += length;
+            return;
+        }
+        regs[op->rd] = regs[op->rs1] + op->imm;
+        vm->pc += length;
+        return;
+    case OP_XORI:
+        if (op->rd == 0)
+        {
+            vm->pc += length;
+            return;
+        }
+        regs[op->rd] = regs[op->rs1] ^ op->imm;
+        vm->pc += length;
+        return;
+    case OP_ORI:
+        if (op->rd == 0)
+        {
+            vm->pc += length;
+            return;
+        }
+        regs[op->rd] = regs[op->rs1] | op->imm;
+        vm->pc += length;
+        return;
+    case OP_ANDI:
+        if (op->rd == 0)
+        {
+            vm->pc += length;
+            return;
+        }
+        regs[op->rd] = regs[op->rs1] & op->imm;
+        vm->pc += length;
+        return;
+    case OP_SLTI:
+        if (op->rd == 0)
+        {
+            vm->pc += length;
+            return;
+        }
+        regs[op->rd] = (regs[op->rs1] < op->imm) ? 1 : 0;
+        vm->pc += length;
+        return;
+    case OP_SLTIU:
+    {
+        if (op->rd == 0)
+        {
+            vm->pc += length;
+            return;
+        }
+        unsigned int unsignedImmI = (unsigned int)op->imm; // cast to treat the imm as unsigned
+        regs[op->rd] = ((unsigned int)regs[op->rs1] < unsignedImmI) ? 1 : 0;
+        vm->pc += length;
+        return;
+    }
+    case OP_LB:
+    {
+        if (op->rd == 0)
+        {
+            vm->pc += length;
+            return;
+        }
+        unsigned int address = regs[op->rs1] + op->imm;
+        unsigned char *source = loadAddress(vm, address, 1);
+        if (source == NULL) // not memory: a device register or a fault
+        {
+            deviceLoad(vm, op, address);
+            return;
+        }
+        regs[op->rd] = (int8_t)source[0];
+        vm->pc += length;
+        return;
+    }
+    case OP_LH:
+    {
+        if (op->rd == 0)
+        {
+            vm->pc += length;
+            return;
+        }
+        unsigned int address = regs[op->rs1] + op->imm;
+        unsigned char *source = loadAddress(vm, address, 2);
+        if (source == NULL) // not memory: a device register or a fault
+        {
+            deviceLoad(vm, op, address);
+            return;
+        }
+        regs[op->rd] = (int16_t)load16(source);
+        vm->pc += length;
+        return;
+    }
+    case OP_LW:
+    {
+        if (op->rd == 0)
+        {
+            vm->pc += length;
+            return;
+        }
+        unsigned int address = regs[op->rs1] + op->imm;
+        unsigned char *source = loadAddress(vm, address, 4);
+        if (source == NULL) // not memory: a device register or a fault
+        {
+            deviceLoad(vm, op, address);
+            return;
+        }
+        regs[op->rd] = (int)load32(source);
+        vm->pc += length;
+        return;
+    }
+    case OP_LBU:
+    {
+        if (op->rd == 0)
+        {
+            vm->pc += length;
+            return;
+        }
+        unsigned int address = regs[op->rs1] + op->imm;
+        unsigned char *source = loadAddress(vm, address, 1);
+        if (source == NULL) // not memory: a device register or a fault
+        {
+            deviceLoad(vm, op, address);
+            return;
+        }
+        regs[op->rd] = source[0];
+        vm->pc += length;
+        return;
+    }
+    case OP_LHU:
+    {
+        if (op->rd == 0)
+        {
+            vm->pc += length;
+            return;
+        }
+        unsigned int address = regs[op->rs1] + op->imm;
+        unsigned char *source = loadAddress(vm, address, 2);
+        if (source == NULL) // not memory: a device register or a fault
+        {
+            deviceLoad(vm, op, address);
+            return;
+        }
+        regs[op->rd] = load16(source);
+        vm->pc += length;
+        return;
+    }
+    case OP_JALR:
+    {
+        int target = regs[op->rs1] + op->imm;
+        if (target < 0 || target > vm->instSize - 2 || (target & 1)) // the one control transfer whose target is only known at run time
+        {
+            illegalOperation(vm);
+            return;
+        }
+        if (op->rd != 0)
+        {
+            regs[op->rd] = vm->pc + length;
+        }
+        vm->pc = target;
+        return;
+    }
+    case OP_SB:
+    {
+        unsigned int address = regs[op->rs1] + op->imm;
+        unsigned char *target = storeAddress(vm, address, 1);
+        if (target == NULL)
+        {
+            deviceStore(vm, op, address, regs[op->rs2]);
+            return;
+        }
+        target[0] = regs[op->rs2];
+        vm->pc += length;
+        return;
+    }
+    case OP_SH:
+    {
+        unsigned int address = regs[op->rs1] + op->imm;
+        unsigned char *target = storeAddress(vm, address, 2);
+        if (target == NULL)
+        {
+            deviceStore(vm, op, address, regs[op->rs2]);
+            return;
+        }
+        store16(target, regs[op->rs2]);
+        vm->pc += length;
+        return;
+    }
+    case OP_SW:
+    {
+        unsigned int address = regs[op->rs1] + op->imm;
+        unsigned char *target = storeAddress(vm, address, 4);
+        if (target == NULL)
+        {
+            deviceStore(vm, op, address, regs[op->rs2]);
+            return;
+        }
+        store32(target, regs[op->rs2]);
+        vm->pc += length;
+        return;
+    }
+    case OP_BEQ:
+        if (regs[op->rs1] == regs[op->rs2])
+        {
+            vm->pc = vm->pc + op->imm;
+            return;
+        }
+        vm->pc += length;
+        return;
+    case OP_BNE:
+        if (regs[op->rs1] != regs[op->rs2])
+        {
+            vm->pc = vm->pc + op->imm;
+            return;
+        }
+        vm->pc += length;
+        return;
+    case OP_BLT:
+    {
+        int signedRs1 = (int)regs[op->rs1];
+        int signedRs2 = (int)regs[op->rs2];
+        if (signedRs1 < signedRs2)
+        {
+            vm->pc = vm->pc + op->imm;
+            return;
+        }
+        vm->pc += length;
+        return;
+    }
+    case OP_BLTU:
+        if (regs[op->rs1] < regs[op->rs2])
+        {
+            vm->pc = vm->pc + op->imm;
+            return;
+        }
+        vm->pc += length;
+        return;
+    case OP_BGE:
+    {
+        int signedRs1 = (int)regs[op->rs1];
+        int signedRs2 = (int)regs[op->rs2];
+        if (signedRs1 >= signedRs2)
+        {
+            vm->pc = vm->pc + op->imm;
+            return;
+        }
+        vm->pc += length;
+        return;
+    }
+    case OP_BGEU:
+        if (regs[op->rs1] >= regs[op->rs2])
+        {
+            vm->pc = vm->pc + op->imm;
+            return;
+        }
+        vm->pc += length;
+        return;
+    case OP_LUI:
+        if (op->rd == 0)
+        {
+            vm->pc += length;
+            return;
+        }
+        regs[op->rd] = op->imm;
+        vm->pc += length;
+        return;
+    case OP_JAL:
+        if (op->rd != 0)
+        {
+            regs[op->rd] = vm->pc + length;
+        }
+        vm->pc = vm->pc + op->imm;
+        return;
+    case OP_MUL:
+    case OP_MULH:
+    case OP_MULHSU:
+    case OP_MULHU:
+    case OP_DIV:
+    case OP_DIVU:
+    case OP_REM:
+    case OP_REMU:
+        if (op->rd != 0)
+        {
+            regs[op->rd] = multiplyDivide(op->handler, regs[op->rs1], regs[op->rs2]);
+        }
+        vm->pc += length;
+        return;
+    case OP_FAR_BRANCH: // target proven out of range or misaligned at load time, only an error once taken
+        if (branchTaken(op->rd, regs[op->rs1], regs[op->rs2]))
+        {
+            illegalOperation(vm);
+            return;
+        }
+        vm->pc += length;
+        return;
+    case OP_END_OF_PROGRAM:
+        vm->status = VM_END_OF_PROGRAM;
+        return;
+    default:
+        notImplemented(vm);
+        return;
+    }
+}
+
+void execute(VM *vm, const DecodedOp *op)
+{
+    if (op->compressed)
+    {
+        executeSized(vm, op, 2);
+        return;
+    }
+    executeSized(vm, op, 4);
+}
+
+uint64_t runSwitch(VM *vm, uint64_t remaining) // returns the part of the budget left over
+{
+    while (remaining && vm->status == VM_RUNNING) // one slot per halfword, pc is always even
+    {
+        execute(vm, &vm->decodedOps[vm->pc >> 1]);
+        remaining--;
+    }
+    return remaining;
+}
+
+#if defined(__GNUC__) || defined(__clang__)
+// Direct-threaded engine: every instruction slot holds the address of its handler, and every handler
+// ends in its own indirect jump to the next one, so the branch predictor sees one jump site per handler
+// instead of the single shared one in runSwitch(). Results are identical to the switch interpreter,
+// the memory and control transfer ops that need the slow paths simply reuse execute().
+#if !defined(__clang__)
+__attribute__((optimize("no-crossjumping"))) // gcc would otherwise merge the handlers' identical dispatch tails into a few
+#endif
+uint64_t runThreaded(VM *vm, uint64_t remaining)
+{
+    static void *const labels[NUM_OP_HANDLERS] = {
+        &&do_add, &&do_sub, &&do_xor, &&do_or, &&do_and, &&do_sll, &&do_srl, &&do_sra, &&do_slt, &&do_sltu,
+        &&do_addi, &&do_xori, &&do_ori, &&do_andi, &&do_slti, &&do_sltiu,
+        &&do_execute, &&do_execute, &&do_execute, &&do_execute, &&do_execute, &&do_execute,
+        &&do_execute, &&do_execute, &&do_execute,
+        &&do_beq, &&do_bne, &&do_blt, &&do_bltu, &&do_bge, &&do_bgeu,
+        &&do_lui, &&do_execute,
+        &&do_muldiv, &&do_muldiv, &&do_muldiv, &&do_muldiv, &&do_muldiv, &&do_muldiv, &&do_muldiv, &&do_muldiv,
+        &&do_execute, &&do_execute, &&do_execute};
+    static void *const compressedLabels[NUM_OP_HANDLERS] = { // the handlers RVC expands to, moving pc by 2
+        &&do_c_add, &&do_c_sub, &&do_c_xor, &&do_c_or, &&do_c_and, &&do_execute, &&do_execute, &&do_execute, &&do_execute, &&do_execute,
+        &&do_c_addi, &&do_execute, &&do_execute, &&do_c_andi, &&do_execute, &&do_execute,
+        &&do_execute, &&do_execute, &&do_execute, &&do_execute, &&do_execute, &&do_execute,
+        &&do_execute, &&do_execute, &&do_execute,
+        &&do_c_beq, &&do_c_bne, &&do_execute, &&do_execute, &&do_execute, &&do_execute,
+        &&do_c_lui, &&do_execute,
+        &&do_execute, &&do_execute, &&do_execute, &&do_execute, &&do_execute, &&do_execute, &&do_execute, &&do_execute,
+        &&do_execute, &&do_execute, &&do_execute};
+    static void *const fusedLabels[NUM_FUSED_OPS] = {
+        NULL, &&fuse_lui_addi_sw, &&fuse_lui_addi, &&fuse_addi_sw,
+        &&fuse_slt_bne, &&fuse_slt_beq, &&fuse_sltu_bne, &&fuse_sltu_beq};
+    int *regs = vm->regs;
+    const DecodedOp *op;
+
+    if (!vm->threadedReady)
+    {
+        for (int i = 0; i <= vm->numSlots; i++)
+        {
+            uint8_t fused = vm->fusion ? vm->fusedOps[i] : FUSE_NONE;
+            void *const *handlers = vm->decodedOps[i].compressed ? compressedLabels : labels;
+            vm->threadedCode[i] = fused ? fusedLabels[fused] : handlers[vm->decodedOps[i].handler];
+        }
+        vm->threadedReady = 1;
+    }
+
+#define DISPATCH()                              \
+    do                                          \
+    {                                           \
+        if (remaining == 0)                     \
+        {                                       \
+            return 0;                           \
+        }                                       \
+        remaining--;                            \
+        op = &vm->decodedOps[vm->pc >> 1];      \
+        goto *vm->threadedCode[vm->pc >> 1];    \
+    } while (0)
+#define DISPATCH_CHECKED()                      \
+    do                                          \
+    {                                           \
+        if (vm->status != VM_RUNNING)           \
+        {                                       \
+            return remaining;                   \
+        }                                       \
+        DISPATCH();                             \
+    } while (0)
+#define ALU_OP(expr, length)   \
+    if (op->rd != 0)           \
+    {                          \
+        regs[op->rd] = (expr); \
+    }                          \
+    vm->pc += (length);        \
+    DISPATCH()
+#define BRANCH_OP(cond, length)    \
+    if (cond)                      \
+    {                              \
+        vm->pc = vm->pc + op->imm; \
+        DISPATCH();                \
+    }                              \
+    vm->pc += (length);            \
+    DISPATCH()
+// A superinstruction retires length instructions for one dispatch; with too little budget left for
+// all of them the first instruction runs on its own, so budgets still stop on the exact instruction.
+// Idioms are made of 4-byte instructions only, see fuseOps().
+#define FUSED(length)                                \
+    if (remaining < (length) - 1)                    \
+    {                                                \
+        goto *labels[op->handler];                   \
+    }                                                \
+    remaining -= (length) - 1;                       \
+    vm->fusionStats.dispatches++;                    \
+    vm->fusionStats.retired += (length)
+#define COMPARE_BRANCH(compare, branch)             \
+    FUSED(2);                                       \
+    if (op->rd != 0)                                \
+    {                                               \
+        regs[op->rd] = (compare) ? 1 : 0;           \
+    }                                               \
+    vm->pc += 4;                                    \
+    op += 2;                                        \
+    goto branch
+
+    if (vm->status != VM_RUNNING)
+    {
+        return remaining;
+    }
+    DISPATCH();
+
+do_add:
+    ALU_OP(regs[op->rs1] + regs[op->rs2], 4);
+do_sub:
+    ALU_OP(regs[op->rs1] - regs[op->rs2], 4);
+do_xor:
+    ALU_OP(regs[op->rs1] ^ regs[op->rs2], 4);
+do_or:
+    ALU_OP(regs[op->rs1] | regs[op->rs2], 4);
+do_and:
+    ALU_OP(regs[op->rs1] & regs[op->rs2], 4);
+do_sll:
+    ALU_OP(regs[op->rs1] << regs[op->rs2], 4);
+do_srl:
+    ALU_OP(regs[op->rs1] >> regs[op->rs2], 4);
+do_slt:
+    ALU_OP((regs[op->rs1] < regs[op->rs2]) ? 1 : 0, 4);
+do_sltu:
+    ALU_OP((regs[op->rs1] < regs[op->rs2]) ? 1 : 0, 4);
+do_muldiv:
+    ALU_OP(multiplyDivide(op->handler, regs[op->rs1], regs[op->rs2]), 4);
+do_addi:
+    ALU_OP(regs[op->rs1] + op->imm, 4);
+do_xori:
+    ALU_OP(regs[op->rs1] ^ op->imm, 4);
+do_ori:
+    ALU_OP(regs[op->rs1] | op->imm, 4);
+do_andi:
+    ALU_OP(regs[op->rs1] & op->imm, 4);
+do_slti:
+    ALU_OP((regs[op->rs1] < op->imm) ? 1 : 0, 4);
+do_sltiu:
+    ALU_OP(((unsigned int)regs[op->rs1] < (unsigned int)op->imm) ? 1 : 0, 4);
+do_lui:
+    ALU_OP(op->imm, 4);
+do_beq:
+    BRANCH_OP(regs[op->rs1] == regs[op->rs2], 4);
+do_bne:
+    BRANCH_OP(regs[op->rs1] != regs[op->rs2], 4);
+do_blt:
+    BRANCH_OP(regs[op->rs1] < regs[op->rs2], 4);
+do_bltu:
+    BRANCH_OP(regs[op->rs1] < regs[op->rs2], 4);
+do_bge:
+    BRANCH_OP(regs[op->rs1] >= regs[op->rs2], 4);
+do_bgeu:
+    BRANCH_OP(regs[op->rs1] >= regs[op->rs2], 4);
+do_c_add: // RVC ops expanded to the handlers above, with pc moving by 2
+    ALU_OP(regs[op->rs1] + regs[op->rs2], 2);
+do_c_sub:
+    ALU_OP(regs[op->rs1] - regs[op->rs2], 2);
+do_c_xor:
+    ALU_OP(regs[op->rs1] ^ regs[op->rs2], 2);
+do_c_or:
+    ALU_OP(regs[op->rs1] | regs[op->rs2], 2);
+do_c_and:
+    ALU_OP(regs[op->rs1] & regs[op->rs2], 2);
+do_c_addi:
+    ALU_OP(regs[op->rs1] + op->imm, 2);
+do_c_andi:
+    ALU_OP(regs[op->rs1] & op->imm, 2);
+do_c_lui:
+    ALU_OP(op->imm, 2);
+do_c_beq:
+    BRANCH_OP(regs[op->rs1] == regs[op->rs2], 2);
+do_c_bne:
+    BRANCH_OP(regs[op->rs1] != regs[op->rs2], 2);
+do_sra:
+do_execute:
+    execute(vm, op);
+    DISPATCH_CHECKED();
+
+fuse_lui_addi_sw:
+    FUSED(3);
+    if (op->rd != 0)
+    {
+        regs[op->rd] = op->imm + op[2].imm;
+    }
+    vm->pc += 8;
+    execute(vm, op + 4);
+    DISPATCH_CHECKED();
+fuse_lui_addi:
+    FUSED(2);
+    if (op->rd != 0)
+    {
+        regs[op->rd] = op->imm + op[2].imm;
+    }
+    vm->pc += 8;
+    DISPATCH();
+fuse_addi_sw:
+    FUSED(2);
+    if (op->rd != 0)
+    {
+        regs[op->rd] = regs[op->rs1] + op->imm;
+    }
+    vm->pc += 4;
+    execute(vm, op + 2);
+    DISPATCH_CHECKED();
+fuse_slt_bne:
+    COMPARE_BRANCH(regs[op->rs1] < regs[op->rs2], do_bne);
+fuse_slt_beq:
+    COMPARE_BRANCH(regs[op->rs1] < regs[op->rs2], do_beq);
+fuse_sltu_bne:
+    COMPARE_BRANCH(regs[op->rs1] < regs[op->rs2], do_bne);
+fuse_sltu_beq:
+    COMPARE_BRANCH(regs[op->rs1] < regs[op->rs2], do_beq);
+
+#undef COMPARE_BRANCH
+#undef FUSED
+#undef BRANCH_OP
+#undef ALU_OP
+#undef DISPATCH_CHECKED
+#undef DISPATCH
+}
+#else
+uint64_t runThreaded(VM *vm, uint64_t remaining) // no computed goto on this compiler, fall back to the switch interpreter
+{
+    return runSwitch(vm, remaining);
+}
+#endif
+
+#if JIT_SUPPORT
+// Tiered x86-64 JIT. The interpreter counts how often each block leader (a pc reached by a jump, or
+// where a run or a previous block stopped) is entered, and once a leader reaches the threshold the
+// straight-line code from there is compiled. Guest registers the block uses most live in host
+// registers, heap loads and stores are inlined behind one unsigned bounds check, and a block ends
+// on its first branch or jal or before the first instruction it cannot compile. Anything else, a
+// device access or an address outside the heap, bails out: the registers are written back and the
+// interpreter carries on at that instruction, so the state is exactly what it would have run into.
+#define JIT_MAX_BLOCK 64       // instructions per block
+#define JIT_MAX_BLOCK_BYTES 4096 // worst case machine code for one block, compiling stops when less is left
+#define JIT_NEVER 0xFFFF       // jitCounts value of a leader that cannot be compiled
+#define JIT_BAIL 0x80000000u   // result flag: the instruction at the returned pc still has to run in the interpreter
+
+enum // x86-64 register numbers
+{
+    RAX = 0,
+    RCX = 1,
+    RDX = 2,
+    RBX = 3,
+    RSI = 6,
+    RDI = 7,
+    R8 = 8
+};
+
+typedef struct
+{
+    uint8_t *at;
+    int hostReg[NUM_REGS]; // host register caching each guest register, -1 when it stays in regs[] (always for x0)
+    uint8_t *bailJumps[JIT_MAX_BLOCK + 1]; // rel32 fields that jump to an exit stub, with the result that exit returns
+    uint64_t bailResults[JIT_MAX_BLOCK + 1];
+    int bails;
+    unsigned int heapStart; // the VM's heap, compiled into the bounds checks
+    unsigned int heapBytes;
+} JitEmitter;
+
+const int jitHostRegs[] = {RBX, R8, R8 + 1, R8 + 2, R8 + 3, R8 + 4, R8 + 5, R8 + 6, R8 + 7};
+#define JIT_HOST_REGS (int)(sizeof(jitHostRegs) / sizeof(jitHostRegs[0]))
+
+void jitByte(JitEmitter *e, uint8_t byte)
+{
+    *e->at++ = byte;
+}
+
+void jit32(JitEmitter *e, uint32_t value)
+{
+    memcpy(e->at, &value, 4);
+    e->at += 4;
+}
+
+void jitRegReg(JitEmitter *e, uint8_t opcode, int reg, int rm) // 32-bit opcode with ModRM reg, rm both registers
+{
+    if (reg >= 8 || rm >= 8)
+    {
+        jitByte(e, 0x40 | (reg >= 8) << 2 | (rm >= 8));
+    }
+    jitByte(e, opcode);
+    jitByte(e, 0xC0 | (reg & 7) << 3 | (rm & 7));
+}
+
+void jitRegSlot(JitEmitter *e, uint8_t opcode, int reg, int guest) // opcode with rm = regs[guest], addressed as [rdi + disp8]
+{
+    if (reg >= 8)
+    {
+        jitByte(e, 0x44);
+    }
+    jitByte(e, opcode);
+    jitByte(e, 0x40 | (reg & 7) << 3 | RDI);
+    jitByte(e, guest * 4);
+}
+
+void jitRegGuest(JitEmitter *e, uint8_t opcode, int reg, int guest) // opcode reg, guest register wherever it lives
+{
+    if (e->hostReg[guest] >= 0)
+    {
+        jitRegReg(e, opcode, reg, e->hostReg[guest]);
+    }
+    else
+    {
+        jitRegSlot(e, opcode, reg, guest);
+    }
+}
+
+void jitAluImmediate(JitEmitter *e, uint8_t opcode, int32_t imm) // the short eax, imm32 forms
+{
+    jitByte(e, opcode);
+    jit32(e, imm);
+}
+
+void jitSetFlag(JitEmitter *e, uint8_t condition) // eax = condition ? 1 : 0 after a cmp
+{
+    jitByte(e, 0x0F);
+    jitByte(e, 0x90 | condition);
+    jitByte(e, 0xC0); // setcc al
+    jitByte(e, 0x0F);
+    jitByte(e, 0xB6);
+    jitByte(e, 0xC0); // movzx eax, al
+}
+
+void jitExit(JitEmitter *e, uint64_t result) // movabs rax, result
+{
+    jitByte(e, 0x48);
+    jitByte(e, 0xB8 | RAX);
+    memcpy(e->at, &result, 8);
+    e->at += 8;
+}
+
+uint64_t jitResult(int retired, int pc, uint32_t flags)
+{
+    return (uint64_t)retired << 32 | (uint32_t)pc | flags;
+}
+
+void jitJumpToStub(JitEmitter *e, uint8_t condition, uint64_t result) // jcc rel32, patched once the stub exists
+{
+    jitByte(e, 0x0F);
+    jitByte(e, 0x80 | condition);
+    e->bailJumps[e->bails] = e->at;
+    e->bailResults[e->bails++] = result;
+    jit32(e, 0);
+}
+
+void jitHeapAddress(JitEmitter *e, const DecodedOp *op, int size, int retired, int pc) // rax = heap offset, bail unless the access fits the heap
+{
+    jitRegGuest(e, 0x8B, RAX, op->rs1);
+    jitAluImmediate(e, 0x05, op->imm - e->heapStart); // add
+    jitAluImmediate(e, 0x3D, e->heapBytes - size); // cmp, unsigned so addresses below the heap wrap high
+    jitJumpToStub(e, 0x7, jitResult(retired, pc, JIT_BAIL)); // ja
+}
+
+int jitWritesRegister(const DecodedOp *op) // x0 is never written, by execute() or by compiled code
+{
+    return op->rd != 0 && !(op->handler >= OP_SB && op->handler <= OP_BGEU);
+}
+
+int jitCompilable(const DecodedOp *op) // straight-line ops with inline code
+{
+    switch (op->handler)
+    {
+    case OP_ADD:
+    case OP_SUB:
+    case OP_XOR:
+    case OP_OR:
+    case OP_AND:
+    case OP_SLL:
+    case OP_SRL:
+    case OP_SLT:
+    case OP_SLTU:
+    case OP_ADDI:
+    case OP_XORI:
+    case OP_ORI:
+    case OP_ANDI:
+    case OP_SLTI:
+    case OP_SLTIU:
+    case OP_LUI:
+    case OP_MUL:
+    case OP_LB:
+    case OP_LH:
+    case OP_LW:
+    case OP_LBU:
+    case OP_LHU:
+    case OP_SB:
+    case OP_SH:
+    case OP_SW:
+        return 1;
+    default:
+        return 0; // sra, jalr, the high multiplies and division stay with the interpreter
+    }
+}
+
+void jitInstruction(JitEmitter *e, const DecodedOp *op, int retired, int pc)
+{
+    static const uint8_t aluOpcodes[] = {[OP_ADD] = 0x03, [OP_SUB] = 0x2B, [OP_XOR] = 0x33, [OP_OR] = 0x0B, [OP_AND] = 0x23};
+    static const uint8_t immediateOpcodes[] = {[OP_ADDI] = 0x05, [OP_XORI] = 0x35, [OP_ORI] = 0x0D, [OP_ANDI] = 0x25};
+    if (op->rd == 0 && !(op->handler >= OP_SB && op->handler <= OP_SW)) // register writes to x0 and loads into it do nothing, as in execute()
+    {
+        return;
+    }
+    switch (op->handler)
+    {
+    case OP_ADD:
+    case OP_SUB:
+    case OP_XOR:
+    case OP_OR:
+    case OP_AND:
+        jitRegGuest(e, 0x8B, RAX, op->rs1);
+        jitRegGuest(e, aluOpcodes[op->handler], RAX, op->rs2);
+        break;
+    case OP_SLL:
+    case OP_SRL: // signed shift, the interpreter shifts an int
+        jitRegGuest(e, 0x8B, RAX, op->rs1);
+        jitRegGuest(e, 0x8B, RCX, op->rs2);
+        jitByte(e, 0xD3);
+        jitByte(e, op->handler == OP_SLL ? 0xE0 : 0xF8); // shl eax, cl / sar eax, cl
+        break;
+    case OP_SLT:
+    case OP_SLTU: // signed compare like the interpreter
+        jitRegGuest(e, 0x8B, RAX, op->rs1);
+        jitRegGuest(e, 0x3B, RAX, op->rs2);
+        jitSetFlag(e, 0xC); // l
+        break;
+    case OP_ADDI:
+    case OP_XORI:
+    case OP_ORI:
+    case OP_ANDI:
+        jitRegGuest(e, 0x8B, RAX, op->rs1);
+        jitAluImmediate(e, immediateOpcodes[op->handler], op->imm);
+        break;
+    case OP_SLTI:
+    case OP_SLTIU:
+        jitRegGuest(e, 0x8B, RAX, op->rs1);
+        jitAluImmediate(e, 0x3D, op->imm);
+        jitSetFlag(e, op->handler == OP_SLTI ? 0xC : 0x2); // l / b
+        break;
+    case OP_LUI:
+        jitAluImmediate(e, 0xB8, op->imm); // mov eax, imm32
+        break;
+    case OP_MUL:
+        jitRegGuest(e, 0x8B, RAX, op->rs1);
+        jitRegGuest(e, 0x8B, RCX, op->rs2);
+        jitByte(e, 0x0F);
+        jitByte(e, 0xAF);
+        jitByte(e, 0xC1); // imul eax, ecx
+        break;
+    case OP_LB:
+    case OP_LH:
+    case OP_LW:
+    case OP_LBU:
+    case OP_LHU:
+    {
+        static const uint8_t loadOpcodes[] = {[OP_LB] = 0xBE, [OP_LH] = 0xBF, [OP_LBU] = 0xB6, [OP_LHU] = 0xB7}; // movsx / movzx
+        jitHeapAddress(e, op, op->handler == OP_LW ? 4 : (op->handler == OP_LH || op->handler == OP_LHU) ? 2 : 1, retired, pc);
+        if (op->handler == OP_LW)
+        {
+            jitByte(e, 0x8B); // mov eax, [rsi + rax]
+        }
+        else
+        {
+            jitByte(e, 0x0F);
+            jitByte(e, loadOpcodes[op->handler]); // eax, byte / word [rsi + rax]
+        }
+        jitByte(e, 0x04);
+        jitByte(e, 0x06);
+        break;
+    }
+    case OP_SB:
+    case OP_SH:
+    case OP_SW:
+        jitHeapAddress(e, op, op->handler == OP_SB ? 1 : op->handler == OP_SH ? 2 : 4, retired, pc);
+        jitRegGuest(e, 0x8B, RCX, op->rs2);
+        if (op->handler == OP_SH)
+        {
+            jitByte(e, 0x66);
+        }
+        jitByte(e, op->handler == OP_SB ? 0x88 : 0x89);
+        jitByte(e, 0x0C);
+        jitByte(e, 0x06); // mov [rsi + rax], cl / cx / ecx
+        return;
+    }
+    jitRegGuest(e, 0x89, RAX, op->rd);
+}
+
+void jitPrologue(JitEmitter *e)
+{
+    jitByte(e, 0x53); // push rbx
+    for (int reg = 12; reg <= 15; reg++)
+    {
+        jitByte(e, 0x41);
+        jitByte(e, 0x50 | (reg & 7)); // push r12 .. r15
+    }
+    for (int guest = 1; guest < NUM_REGS; guest++)
+    {
+        if (e->hostReg[guest] >= 0)
+        {
+            jitRegSlot(e, 0x8B, e->hostReg[guest], guest);
+        }
+    }
+}
+
+void jitEpilogue(JitEmitter *e, const uint8_t *written) // write cached registers back and return rax
+{
+    for (int guest = 1; guest < NUM_REGS; guest++)
+    {
+        if (e->hostReg[guest] >= 0 && written[guest])
+        {
+            jitRegSlot(e, 0x89, e->hostReg[guest], guest);
+        }
+    }
+    for (int reg = 15; reg >= 12; reg--)
+    {
+        jitByte(e, 0x41);
+        jitByte(e, 0x58 | (reg & 7)); // pop r15 .. r12
+    }
+    jitByte(e, 0x5B); // pop rbx
+    jitByte(e, 0xC3); // ret
+}
+
+void jitCompile(VM *vm, int slot)
+{
+    vm->jitCounts[slot] = JIT_NEVER; // whatever happens, this leader is only compiled once
+    if (vm->jitCode == NULL)
+    {
+        void *code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (code == MAP_FAILED)
+        {
+            return;
+        }
+        vm->jitCode = code;
+    }
+    if (JIT_CODE_SIZE - vm->jitUsed < JIT_MAX_BLOCK_BYTES)
+    {
+        return;
+    }
+
+    const DecodedOp *ops[JIT_MAX_BLOCK + 1]; // the block's instructions in program order, 2 or 4 bytes apart
+    int pcs[JIT_MAX_BLOCK + 1];
+    int length = 0;
+    int terminator = 0; // the block ends in a branch or jal, included in length
+    int pc = slot * 2;
+    while (length < JIT_MAX_BLOCK && pc < vm->instSize && jitCompilable(&vm->decodedOps[pc >> 1]))
+    {
+        ops[length] = &vm->decodedOps[pc >> 1];
+        pcs[length] = pc;
+        pc += opLength(ops[length++]);
+    }
+    if (length < JIT_MAX_BLOCK && pc < vm->instSize)
+    {
+        const DecodedOp *last = &vm->decodedOps[pc >> 1];
+        if ((last->handler >= OP_BEQ && last->handler <= OP_BGEU) || last->handler == OP_JAL)
+        {
+            ops[length] = last;
+            terminator = 1; // targets were proven in range at load time, far branches stay with the interpreter
+        }
+    }
+    if (length + terminator == 0)
+    {
+        return;
+    }
+
+    int uses[NUM_REGS] = {0};
+    uint8_t written[NUM_REGS] = {0};
+    for (int i = 0; i < length + terminator; i++)
+    {
+        uses[ops[i]->rs1]++;
+        uses[ops[i]->rs2]++;
+        uses[ops[i]->rd]++;
+        written[ops[i]->rd] |= jitWritesRegister(ops[i]);
+    }
+    uses[0] = 0;
+    JitEmitter emitter = {.at = vm->jitCode + vm->jitUsed, .heapStart = vm->heapStart, .heapBytes = vm->heapEnd - vm->heapStart};
+    JitEmitter *e = &emitter;
+    for (int guest = 0; guest < NUM_REGS; guest++)
+    {
+        e->hostReg[guest] = -1;
+    }
+    for (int host = 0; host < JIT_HOST_REGS; host++) // the most used guest registers get host registers
+    {
+        int best = 0;
+        for (int guest = 1; guest < NUM_REGS; guest++)
+        {
+            if (e->hostReg[guest] < 0 && uses[guest] > uses[best])
+            {
+                best = guest;
+            }
+        }
+        if (best == 0)
+        {
+            break;
+        }
+        e->hostReg[best] = jitHostRegs[host];
+        uses[best] = 0;
+    }
+
+    mprotect(vm->jitCode, JIT_CODE_SIZE, PROT_READ | PROT_WRITE);
+    uint8_t *entry = e->at;
+    jitPrologue(e);
+    uint8_t *loopTop = e->at; // a branch back to the block start re-enters here with the registers still cached
+    uint8_t *backEdge = NULL;
+    for (int i = 0; i < length; i++)
+    {
+        jitInstruction(e, ops[i], i, pcs[i]);
+    }
+    uint64_t result = jitResult(length, pc, 0); // ran into an instruction the JIT leaves to the interpreter
+    if (terminator)
+    {
+        const DecodedOp *last = ops[length];
+        result = jitResult(length + 1, pc + opLength(last), 0);
+        if (last->handler == OP_JAL)
+        {
+            if (last->rd != 0)
+            {
+                jitAluImmediate(e, 0xB8, pc + opLength(last));
+                jitRegGuest(e, 0x89, RAX, last->rd);
+            }
+            result = jitResult(length + 1, pc + last->imm, 0);
+        }
+        else
+        {
+            static const uint8_t conditions[] = {[OP_BEQ] = 0x4, [OP_BNE] = 0x5, [OP_BLT] = 0xC, [OP_BLTU] = 0xC, [OP_BGE] = 0xD, [OP_BGEU] = 0xD}; // the unsigned branches compare signed in execute() too
+            jitRegGuest(e, 0x8B, RAX, last->rs1);
+            jitRegGuest(e, 0x3B, RAX, last->rs2);
+            if (pc + last->imm == slot * 2) // loop onto itself, stays in compiled code while the budget lasts
+            {
+                jitByte(e, 0x0F);
+                jitByte(e, 0x80 | conditions[last->handler]);
+                backEdge = e->at;
+                jit32(e, 0);
+            }
+            else
+            {
+                jitJumpToStub(e, conditions[last->handler], jitResult(length + 1, pc + last->imm, 0));
+            }
+        }
+    }
+    jitExit(e, result);
+    uint8_t *exit = e->at;
+    jitEpilogue(e, written);
+    if (backEdge != NULL) // jitBudget -= length; keep looping while a whole iteration fits, else leave at the block start
+    {
+        int32_t offset = e->at - (backEdge + 4);
+        memcpy(backEdge, &offset, 4);
+        int32_t budget = (int32_t)(offsetof(VM, jitBudget) - offsetof(VM, regs));
+        jitByte(e, 0x48);
+        jitByte(e, 0x81);
+        jitByte(e, 0x80 | 5 << 3 | RDI); // sub qword [rdi + disp32], imm32
+        jit32(e, budget);
+        jit32(e, length + 1);
+        jitByte(e, 0x48);
+        jitByte(e, 0x81);
+        jitByte(e, 0x80 | 7 << 3 | RDI); // cmp qword [rdi + disp32], imm32
+        jit32(e, budget);
+        jit32(e, length + 1);
+        jitByte(e, 0x0F);
+        jitByte(e, 0x83); // jae rel32
+        jit32(e, loopTop - (e->at + 4));
+        jitExit(e, jitResult(0, slot * 2, 0));
+        jitByte(e, 0xE9);
+        jit32(e, exit - (e->at + 4));
+    }
+    for (int i = 0; i < e->bails; i++) // stubs: load the result and share the exit
+    {
+        int32_t offset = e->at - (e->bailJumps[i] + 4);
+        memcpy(e->bailJumps[i], &offset, 4);
+        jitExit(e, e->bailResults[i]);
+        jitByte(e, 0xE9); // jmp rel32
+        jit32(e, exit - (e->at + 4));
+    }
+    mprotect(vm->jitCode, JIT_CODE_SIZE, PROT_READ | PROT_EXEC);
+
+    vm->jitUsed = e->at - vm->jitCode;
+    vm->jitBlocks[slot] = (JitBlock)entry;
+    vm->jitLengths[slot] = length + terminator;
+    vm->jitStats.blocks++;
+    vm->jitStats.codeBytes = vm->jitUsed;
+}
+
+uint64_t runJit(VM *vm, uint64_t remaining)
+{
+    int leader = 1; // where a run starts counts as a block entry
+    while (remaining && vm->status == VM_RUNNING)
+    {
+        int slot = vm->pc >> 1;
+        if (leader && slot < vm->numSlots)
+        {
+            if (vm->jitBlocks[slot] == NULL && vm->jitCounts[slot] != JIT_NEVER && ++vm->jitCounts[slot] >= vm->jitThreshold)
+            {
+                jitCompile(vm, slot);
+            }
+            if (vm->jitBlocks[slot] != NULL && remaining >= vm->jitLengths[slot]) // a block always fits the budget, so counts stay exact
+            {
+                vm->jitBudget = remaining;
+                uint64_t result = vm->jitBlocks[slot](vm->regs, vm->heapMemory);
+                uint64_t retired = (remaining - vm->jitBudget) + (result >> 32); // whole loop iterations plus the last partial one
+                vm->pc = result & ~JIT_BAIL;
+                remaining -= retired;
+                vm->jitStats.retired += retired;
+                if (!(result & JIT_BAIL)) // stopped on a jump or before an op it does not compile, both start the next block
+                {
+                    continue;
+                }
+                vm->jitStats.bails++;
+                if (remaining == 0)
+                {
+                    break;
+                }
+            }
+        }
+        int pc = vm->pc;
+        const DecodedOp *op = &vm->decodedOps[pc >> 1];
+        execute(vm, op);
+        remaining--;
+        leader = vm->pc != pc + opLength(op);
+    }
+    return remaining;
+}
+#else
+uint64_t runJit(VM *vm, uint64_t remaining) // no JIT for this host, the threaded interpreter runs instead
+{
+    return runThreaded(vm, remaining);
+}
+#endif
+
+#if AOT_SUPPORT
+// Ahead-of-time translation. The instruction memory of an image becomes one C function with a label
+// per instruction: branches and jal become gotos, heap loads and stores are inlined, and every guest
+// register is a local the C compiler can keep in a host register. It is built into a shared object
+// cached on disk under a hash of the instruction memory, so each distinct image is compiled once.
+// Anything the translation cannot prove safe, a device access, an address outside the heap, a jalr
+// with its computed target or a branch out of range, returns the pc of that instruction with the
+// registers written back and the interpreter runs it. Budgets are charged per block on entry and the
+// unused part refunded when the code returns early, so instruction counts are exact.
+const char *aotReg(int reg) // guest register as a C operand of the generated code
+{
+    static const char *names[NUM_REGS] = {
+        "0", "x1", "x2", "x3", "x4", "x5", "x6", "x7", "x8", "x9", "x10", "x11", "x12", "x13", "x14", "x15",
+        "x16", "x17", "x18", "x19", "x20", "x21", "x22", "x23", "x24", "x25", "x26", "x27", "x28", "x29", "x30", "x31"};
+    return names[reg];
+}
+
+int aotEndsBlock(const DecodedOp *op)
+{
+    return (op->handler >= OP_BEQ && op->handler <= OP_BGEU) || op->handler == OP_JAL || op->handler == OP_JALR;
+}
+
+void aotJump(FILE *out, const uint8_t *labelled, int target) // to the block at target, or back to the interpreter when it has no label
+{
+    if (labelled[target / 2])
+    {
+        fprintf(out, "goto B%d;\n", target / 2);
+    }
+    else
+    {
+        fprintf(out, "EXIT(%d, 0);\n", target);
+    }
+}
+
+// Each instruction does exactly what execute() does, quirks included: srl shifts arithmetically, sra is a loop of
+// arithmetic shifts that moves the low bit into bit 31, sltu compares signed. refund is the part of the block budget still unspent
+void aotInstruction(FILE *out, const DecodedOp *op, int pc, int refund, const uint8_t *labelled)
+{
+    const char *rd = aotReg(op->rd);
+    const char *rs1 = aotReg(op->rs1);
+    const char *rs2 = aotReg(op->rs2);
+    static const char *const aluOperators[] = {[OP_ADD] = "+", [OP_SUB] = "-", [OP_XOR] = "^", [OP_OR] = "|", [OP_AND] = "&",
+                                               [OP_ADDI] = "+", [OP_XORI] = "^", [OP_ORI] = "|", [OP_ANDI] = "&"};
+    static const char *const branchOperators[] = {[OP_BEQ] = "==", [OP_BNE] = "!=", [OP_BLT] = "<", [OP_BLTU] = "<", [OP_BGE] = ">=", [OP_BGEU] = ">="};
+    int writes = op->rd != 0;
+    switch (op->handler)
+    {
+    case OP_ADD:
+    case OP_SUB:
+    case OP_XOR:
+    case OP_OR:
+    case OP_AND:
+        if (writes)
+        {
+            fprintf(out, "    %s = (int)((unsigned int)%s %s (unsigned int)%s);\n", rd, rs1, aluOperators[op->handler], rs2);
+        }
+        return;
+    case OP_SLL:
+        if (writes)
+        {
+            fprintf(out, "    %s = (int)((unsigned int)%s << (%s & 31));\n", rd, rs1, rs2);
+        }
+        return;
+    case OP_SRL: // an arithmetic shift, the interpreter shifts an int
+        if (writes)
+        {
+            fprintf(out, "    %s = %s >> (%s & 31);\n", rd, rs1, rs2);
+        }
+        return;
+    case OP_SRA: // the interpreter's loop: the int shifts arithmetically, then the old low bit is ORed into bit 31
+        if (writes) // with rd == rs2 the loop bound is the register being shifted, as in execute()
+        {
+            fprintf(out, "    t = %s;\n    for (int i = 0; i < %s; i++)\n        t = (t >> 1) | (int)(((unsigned int)t & 1) << 31);\n    %s = t;\n", rs1,
+                    op->rd == op->rs2 ? "t" : rs2, rd);
+        }
+        return;
+    case OP_SLT:
+    case OP_SLTU: // signed like the interpreter
+        if (writes)
+        {
+            fprintf(out, "    %s = %s < %s;\n", rd, rs1, rs2);
+        }
+        return;
+    case OP_MUL:
+    case OP_MULH:
+    case OP_MULHSU:
+    case OP_MULHU:
+    case OP_DIV:
+    case OP_DIVU:
+    case OP_REM:
+    case OP_REMU:
+    {
+        static const char *const products[] = {
+            [OP_MUL] = "(int)((uint32_t)%s * (uint32_t)%s)",
+            [OP_MULH] = "(int)(((int64_t)%s * %s) >> 32)",
+            [OP_MULHSU] = "(int)(((int64_t)%s * (int64_t)(uint32_t)%s) >> 32)",
+            [OP_MULHU] = "(int)(((uint64_t)(uint32_t)%s * (uint32_t)%s) >> 32)"};
+        static const char *const quotients[] = {
+            [OP_DIV] = "%2$s == 0 ? -1 : (%1$s == INT32_MIN && %2$s == -1) ? %1$s : %1$s / %2$s",
+            [OP_DIVU] = "%2$s == 0 ? -1 : (int)((uint32_t)%1$s / (uint32_t)%2$s)",
+            [OP_REM] = "%2$s == 0 ? %1$s : (%1$s == INT32_MIN && %2$s == -1) ? 0 : %1$s %% %2$s",
+            [OP_REMU] = "%2$s == 0 ? %1$s : (int)((uint32_t)%1$s %% (uint32_t)%2$s)"};
+        if (writes) // the same expressions as multiplyDivide()
+        {
+            fprintf(out, "    %s = ", rd);
+            fprintf(out, op->handler <= OP_MULHU ? products[op->handler] : quotients[op->handler], rs1, rs2);
+            fprintf(out, ";\n");
+        }
+        return;
+    }
+    case OP_ADDI:
+    case OP_XORI:
+    case OP_ORI:
+    case OP_ANDI:
+        if (writes)
+        {
+            fprintf(out, "    %s = (int)((unsigned int)%s %s (unsigned int)%d);\n", rd, rs1, aluOperators[op->handler], op->imm);
+        }
+        return;
+    case OP_SLTI:
+        if (writes)
+        {
+            fprintf(out, "    %s = %s < %d;\n", rd, rs1, op->imm);
+        }
+        return;
+    case OP_SLTIU:
+        if (writes)
+        {
+            fprintf(out, "    %s = (unsigned int)%s < %uu;\n", rd, rs1, (unsigned int)op->imm);
+        }
+        return;
+    case OP_LUI:
+        if (writes)
+        {
+            fprintf(out, "    %s = %d;\n", rd, op->imm);
+        }
+        return;
+    case OP_LB:
+    case OP_LH:
+    case OP_LW:
+    case OP_LBU:
+    case OP_LHU:
+    {
+        if (!writes) // loads into x0 do nothing, not even the device read
+        {
+            return;
+        }
+        int size = (op->handler == OP_LW) ? 4 : (op->handler == OP_LH || op->handler == OP_LHU) ? 2 : 1;
+        fprintf(out, "    a = (unsigned int)%s + %du - HEAP_START;\n    if (a > HEAP_BYTES - %d) EXIT(%d, %d);\n", rs1, op->imm, size, pc, refund);
+        static const char *const loads[] = {[OP_LB] = "(int8_t)heap[a]", [OP_LH] = "(int16_t)load16(heap + a)", [OP_LW] = "(int)load32(heap + a)", [OP_LBU] = "heap[a]", [OP_LHU] = "load16(heap + a)"};
+        fprintf(out, "    %s = %s;\n", rd, loads[op->handler]);
+        return;
+    }
+    case OP_SB:
+    case OP_SH:
+    case OP_SW:
+    {
+        int size = (op->handler == OP_SW) ? 4 : (op->handler == OP_SH) ? 2 : 1;
+        fprintf(out, "    a = (unsigned int)%s + %du - HEAP_START;\n    if (a > HEAP_BYTES - %d) EXIT(%d, %d);\n", rs1, op->imm, size, pc, refund);
+        static const char *const stores[] = {[OP_SB] = "heap[a] = %s;\n", [OP_SH] = "store16(heap + a, %s);\n", [OP_SW] = "store32(heap + a, %s);\n"};
+        fprintf(out, "    ");
+        fprintf(out, stores[op->handler], rs2);
+        return;
+    }
+    case OP_BEQ:
+    case OP_BNE:
+    case OP_BLT:
+    case OP_BLTU:
+    case OP_BGE:
+    case OP_BGEU:
+        fprintf(out, "    if (%s %s %s) ", rs1, branchOperators[op->handler], rs2);
+        aotJump(out, labelled, pc + op->imm);
+        fprintf(out, "    ");
+        aotJump(out, labelled, pc + opLength(op));
+        return;
+    case OP_JAL:
+        if (writes)
+        {
+            fprintf(out, "    %s = %d;\n", rd, pc + opLength(op));
+        }
+        fprintf(out, "    ");
+        aotJump(out, labelled, pc + op->imm);
+        return;
+    default: // jalr, far branches, unimplemented instructions and the end of the program
+        fprintf(out, "    EXIT(%d, %d);\n", pc, refund);
+        return;
+    }
+}
+
+// Translation stops where the rest of instruction memory is zero, which only decodes to unimplemented
+// instructions, so a large instruction memory holding a small program gives a small translation.
+int aotSweepEnd(const VM *vm)
+{
+    int used = vm->instSize;
+    while (used > 0 && vm->instMemory[used - 1] == 0)
+    {
+        used--;
+    }
+    int end = 0;
+    while (end < vm->numSlots && end * 2 < used)
+    {
+        end += opLength(&vm->decodedOps[end]) / 2;
+    }
+    return end;
+}
+
+int aotTranslate(const VM *vm, FILE *out) // -1 when out of memory
+{
+    const DecodedOp *ops = vm->decodedOps;
+    int end = aotSweepEnd(vm);
+    uint8_t *translated = calloc(end + 1, 1); // the instructions a linear sweep from pc 0 finds, anything else is interpreted
+    uint8_t *leader = calloc(vm->numSlots + 1, 1);
+    int *blockLeft = malloc((end + 1) * sizeof(int)); // instructions from each translated one to the end of its block
+    if (translated == NULL || leader == NULL || blockLeft == NULL)
+    {
+        free(translated);
+        free(leader);
+        free(blockLeft);
+        return -1;
+    }
+    leader[0] = 1;
+    for (int i = 0; i < end; i += opLength(&ops[i]) / 2)
+    {
+        translated[i] = 1;
+        if ((ops[i].handler >= OP_BEQ && ops[i].handler <= OP_BGEU) || ops[i].handler == OP_JAL) // targets proven in range at load time
+        {
+            leader[(i * 2 + ops[i].imm) / 2] = 1;
+        }
+        if (aotEndsBlock(&ops[i]))
+        {
+            leader[i + opLength(&ops[i]) / 2] = 1;
+        }
+    }
+    translated[end] = 1;
+    leader[end] = 1;
+    for (int i = 0; i <= vm->numSlots; i++) // a jump into the middle of a translated instruction, or past the end, goes back to the interpreter
+    {
+        leader[i] &= i <= end && translated[i];
+    }
+    blockLeft[end] = 0;
+    for (int i = end - 1; i >= 0; i--)
+    {
+        int next = i + opLength(&ops[i]) / 2;
+        blockLeft[i] = translated[i] ? 1 + (leader[next] ? 0 : blockLeft[next]) : 0;
+    }
+
+    fprintf(out, "// generated from a RISK-XVII image, instructions are charged per block\n#include <stdint.h>\n#include <string.h>\n");
+    fprintf(out, "#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__\n#define LE16(v) __builtin_bswap16(v)\n#define LE32(v) __builtin_bswap32(v)\n#else\n#define LE16(v) (v)\n#define LE32(v) (v)\n#endif\n");
+    fprintf(out, "static inline uint16_t load16(const unsigned char *p) { uint16_t v; memcpy(&v, p, 2); return LE16(v); }\n");
+    fprintf(out, "static inline uint32_t load32(const unsigned char *p) { uint32_t v; memcpy(&v, p, 4); return LE32(v); }\n");
+    fprintf(out, "static inline void store16(unsigned char *p, uint16_t v) { v = LE16(v); memcpy(p, &v, 2); }\n");
+    fprintf(out, "static inline void store32(unsigned char *p, uint32_t v) { v = LE32(v); memcpy(p, &v, 4); }\n");
+    fprintf(out, "#define HEAP_START %uu\n#define HEAP_BYTES %uu\n", vm->heapStart, vm->heapEnd - vm->heapStart);
+    fprintf(out, "const int riskxviiAotVersion = %d;\n", AOT_VERSION);
+    fprintf(out, "#define EXIT(p, r) do { exitPc = (p); refund = (r); goto leave; } while (0)\n");
+    fprintf(out, "int riskxviiAotRun(int *regs, unsigned char *heap, int pc, uint64_t *budgetInOut)\n{\n");
+    fprintf(out, "    uint64_t budget = *budgetInOut;\n    int exitPc, refund, t;\n    unsigned int a;\n");
+    for (int r = 1; r < NUM_REGS; r++)
+    {
+        fprintf(out, "    int x%d = regs[%d];\n", r, r);
+    }
+    fprintf(out, "    (void)t;\n    (void)a;\n    switch (pc >> 1)\n    {\n");
+    for (int i = 0; i < end; i += opLength(&ops[i]) / 2) // entering mid-block charges the rest of the block
+    {
+        fprintf(out, "    case %d: if (budget < %d) EXIT(%d, 0); budget -= %d; goto L%d;\n", i, blockLeft[i], i * 2, blockLeft[i], i);
+    }
+    fprintf(out, "    default: EXIT(pc, 0);\n    }\n");
+    for (int i = 0; i < end; i += opLength(&ops[i]) / 2)
+    {
+        if (leader[i])
+        {
+            fprintf(out, "B%d:\n    if (budget < %d) EXIT(%d, 0);\n    budget -= %d;\n", i, blockLeft[i], i * 2, blockLeft[i]);
+        }
+        fprintf(out, "L%d:\n", i);
+        aotInstruction(out, &ops[i], i * 2, blockLeft[i], leader);
+    }
+    fprintf(out, "B%d:\n    EXIT(%d, 0);\n", end, end * 2);
+    fprintf(out, "leave:\n");
+    for (int r = 1; r < NUM_REGS; r++)
+    {
+        fprintf(out, "    regs[%d] = x%d;\n", r, r);
+    }
+    fprintf(out, "    *budgetInOut = budget + refund;\n    return exitPc;\n}\n");
+    free(translated);
+    free(leader);
+    free(blockLeft);
+    return 0;
+}
+
+uint64_t aotImageHash(const VM *vm) // FNV-1a over the heap bounds compiled in and instruction memory, data memory is never executed
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    uint32_t layout[3] = {vm->heapStart, vm->heapEnd, (uint32_t)vm->instSize};
+    for (size_t i = 0; i < sizeof(layout); i++)
+    {
+        hash = (hash ^ ((const unsigned char *)layout)[i]) * 0x100000001b3ull;
+    }
+    for (int i = 0; i < vm->instSize; i++)
+    {
+        hash = (hash ^ vm->instMemory[i]) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+int privateDirectory(const char *path) // creates path 0700 if needed, 0 when it is a directory only this user can write to
+{
+    mkdir(path, 0700); // an existing directory is fine, it is checked below either way
+    struct stat status;
+    if (lstat(path, &status) != 0 || !S_ISDIR(status.st_mode) || status.st_uid != geteuid() || (status.st_mode & (S_IWGRP | S_IWOTH)))
+    {
+        return -1;
+    }
+    return 0;
+}
+
+// vmSetAotCache, $RISKXVII_AOT_CACHE, else the user's cache directory. -1 when there is none that is safe to load
+// shared objects from: another user able to plant files there could run code in this process.
+int aotCacheDirectory(const VM *vm, char *directory, size_t size)
+{
+    const char *configured = vm->aotCacheDir ? vm->aotCacheDir : getenv("RISKXVII_AOT_CACHE");
+    const char *xdg = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    if (configured != NULL)
+    {
+        snprintf(directory, size, "%s", configured);
+    }
+    else if (xdg != NULL && xdg[0] != '\0')
+    {
+        snprintf(directory, size, "%s/riskxvii", xdg);
+    }
+    else if (home != NULL && home[0] != '\0')
+    {
+        snprintf(directory, size, "%s/.cache", home);
+        mkdir(directory, 0700);
+        snprintf(directory, size, "%s/.cache/riskxvii", home);
+    }
+    else
+    {
+        return -1; // no shared fallback such as /tmp, anyone could create it first
+    }
+    return privateDirectory(directory);
+}
+
+extern char **environ;
+
+int aotCompile(const char *source, const char *object) // run $CC (cc by default), 0 on success
+{
+    const char *compiler = getenv("CC");
+    if (compiler == NULL || compiler[0] == '\0')
+    {
+        compiler = "cc";
+    }
+    char *const argv[] = {(char *)compiler, "-O2", "-shared", "-fPIC", "-w", "-o", (char *)object, (char *)source, NULL};
+    pid_t child;
+    if (posix_spawnp(&child, compiler, NULL, NULL, argv, environ) != 0)
+    {
+        return -1;
+    }
+    int status;
+    while (waitpid(child, &status, 0) < 0)
+    {
+        if (errno != EINTR)
+        {
+            return -1;
+        }
+    }
+    return (WIFEXITED(status) && WEXITSTATUS(status) == 0) ? 0 : -1;
+}
+
+int vmAotPrepare(VM *vm)
+{
+    aotRelease(vm);
+    vm->aotTried = 1;
+    char directory[4096];
+    if (aotCacheDirectory(vm, directory, sizeof(directory)) != 0)
+    {
+        return -1;
+    }
+
+    size_t length = strlen(directory) + 64;
+    char *object = malloc(length);
+    char *source = malloc(length);
+    char *temporary = malloc(length);
+    if (object == NULL || source == NULL || temporary == NULL)
+    {
+        free(object);
+        free(source);
+        free(temporary);
+        return -1;
+    }
+    uint64_t hash = aotImageHash(vm);
+    snprintf(object, length, "%s/rx%d-%016llx.so", directory, AOT_VERSION, (unsigned long long)hash);
+    int result = 0;
+    if (access(object, R_OK) != 0) // not cached yet: translate, compile to a private name, then publish it atomically
+    {
+        static int counter;
+        int unique = __atomic_fetch_add(&counter, 1, __ATOMIC_RELAXED);
+        snprintf(source, length, "%s/rx%d-%016llx.%d.%d.c", directory, AOT_VERSION, (unsigned long long)hash, (int)getpid(), unique);
+        snprintf(temporary, length, "%s/rx%d-%016llx.%d.%d.so", directory, AOT_VERSION, (unsigned long long)hash, (int)getpid(), unique);
+        FILE *out = fopen(source, "w");
+        if (out == NULL)
+        {
+            result = -1;
+        }
+        else
+        {
+            int translated = aotTranslate(vm, out);
+            result = (fclose(out) == 0 && translated == 0 && aotCompile(source, temporary) == 0 && rename(temporary, object) == 0) ? 0 : -1;
+            unlink(source);
+            unlink(temporary);
+        }
+    }
+    if (result == 0)
+    {
+        vm->aotHandle = dlopen(object, RTLD_NOW | RTLD_LOCAL);
+        const int *version = vm->aotHandle ? dlsym(vm->aotHandle, "riskxviiAotVersion") : NULL;
+        vm->aotRun = vm->aotHandle ? (AotRun)dlsym(vm->aotHandle, "riskxviiAotRun") : NULL;
+        if (version == NULL || *version != AOT_VERSION || vm->aotRun == NULL)
+        {
+            aotRelease(vm);
+            vm->aotTried = 1;
+            result = -1;
+        }
+    }
+    free(object);
+    free(source);
+    free(temporary);
+    return result;
+}
+
+uint64_t runAot(VM *vm, uint64_t remaining)
+{
+    if (!vm->aotTried)
+    {
+        vmAotPrepare(vm);
+    }
+    if (vm->aotRun == NULL) // no compiler or no cache directory, interpret instead
+    {
+        return runThreaded(vm, remaining);
+    }
+    while (remaining && vm->status == VM_RUNNING)
+    {
+        vm->pc = vm->aotRun(vm->regs, vm->heapMemory, vm->pc, &remaining);
+        if (remaining == 0)
+        {
+            break;
+        }
+        execute(vm, &vm->decodedOps[vm->pc >> 1]); // whatever made the native code stop
+        remaining--;
+    }
+    return remaining;
+}
+#else
+int vmAotPrepare(VM *vm)
+{
+    (void)vm;
+    return -1;
+}
+
+uint64_t runAot(VM *vm, uint64_t remaining)
+{
+    return runThreaded(vm, remaining);
+}
+#endif
+
+#if TRACE_SUPPORT
+// The traced engine is a separate loop so the switch and threaded engines carry no trace checks at all
+uint64_t runTraced(VM *vm, uint64_t remaining)
+{
+    while (remaining && vm->status == VM_RUNNING)
+    {
+        const DecodedOp *op = &vm->decodedOps[vm->pc >> 1];
+        int handler = (op->handler == OP_FAR_BRANCH) ? op->rd : op->handler; // traces show the instruction as written
+        remaining--;
+        if (vm->traceLevel == TRACE_TEXT)
+        {
+            if (handler < OP_NOT_IMPLEMENTED && !vm->traceParked) // a retried console read was printed when it first parked
+            {
+                consolePrintf(vm, "%s, pc = %d\n", opNames[handler], vm->pc);
+            }
+            execute(vm, op);
+            vm->traceParked = vm->status == VM_WAITING_INPUT;
+            continue;
+        }
+        TraceRecord *record = &vm->traceRing[vm->traceRecorded++ & (vm->traceCapacity - 1)];
+        record->pc = vm->pc;
+        record->handler = handler;
+        record->rd = (handler >= OP_SB && handler <= OP_BGEU) || op->handler == OP_FAR_BRANCH ? 0 : op->rd; // stores and branches write no register
+        execute(vm, op);
+        record->rdValue = vm->regs[record->rd];
+        if (vm->status == VM_WAITING_INPUT) // recorded once, when the retry retires
+        {
+            vm->traceRecorded--;
+        }
+    }
+    return remaining;
+}
+#endif
+
+int vmSetTrace(VM *vm, TraceLevel level, uint32_t capacity)
+{
+#if TRACE_SUPPORT
+    free(vm->traceRing);
+    vm->traceRing = NULL;
+    vm->traceRecorded = 0;
+    vm->traceParked = 0;
+    vm->traceLevel = level;
+    for (vm->traceCapacity = 1; vm->traceCapacity < capacity && vm->traceCapacity < (1u << 30); vm->traceCapacity <<= 1)
+    {
+    }
+    if (level == TRACE_RECORDS)
+    {
+        vm->traceRing = calloc(vm->traceCapacity, sizeof(TraceRecord));
+        if (vm->traceRing == NULL)
+        {
+            vm->traceLevel = TRACE_OFF;
+            return -1;
+        }
+    }
+    return 0;
+#else
+    (void)vm;
+    (void)capacity;
+    return level == TRACE_OFF ? 0 : -1;
+#endif
+}
+
+int vmWriteTrace(const VM *vm, const char *path)
+{
+    if (vm->traceRing == NULL)
+    {
+        return -1;
+    }
+    FILE *output = fopen(path, "wb");
+    if (output == NULL)
+    {
+        return -1;
+    }
+    TraceFileHeader header = {TRACE_MAGIC, vm->traceCapacity, vm->traceRecorded};
+    fwrite(&header, sizeof(header), 1, output);
+    uint64_t first = (vm->traceRecorded > vm->traceCapacity) ? vm->traceRecorded - vm->traceCapacity : 0;
+    for (uint64_t i = first; i < vm->traceRecorded; i++)
+    {
+        fwrite(&vm->traceRing[i & (vm->traceCapacity - 1)], sizeof(TraceRecord), 1, output);
+    }
+    fclose(output);
+    return 0;
+}
+
+int vmDecodeTraceFile(const char *path, FILE *output) // print a trace file written by vmWriteTrace as text
+{
+    FILE *input = fopen(path, "rb");
+    if (input == NULL)
+    {
+        fprintf(output, "Unable to open trace file: %s\n", path);
+        return 1;
+    }
+    TraceFileHeader header;
+    if (fread(&header, sizeof(header), 1, input) != 1 || header.magic != TRACE_MAGIC)
+    {
+        fprintf(output, "Not a trace file: %s\n", path);
+        fclose(input);
+        return 1;
+    }
+    uint64_t first = (header.recorded > header.capacity) ? header.recorded - header.capacity : 0;
+    fprintf(output, "%llu instructions traced, showing the last %llu\n", (unsigned long long)header.recorded, (unsigned long long)(header.recorded - first));
+    TraceRecord record;
+    for (uint64_t i = first; fread(&record, sizeof(record), 1, input) == 1; i++)
+    {
+        const char *name = (record.handler < NUM_OP_HANDLERS) ? opNames[record.handler] : "?";
+        fprintf(output, "%llu: pc = %u %s x%u = 0x%08x\n", (unsigned long long)i, record.pc, name, record.rd, (unsigned int)record.rdValue);
+    }
+    fclose(input);
+    return 0;
+}
+
+void releaseMemory(VM *vm) // everything whose size follows the memory layout
+{
+    if (vm->arena != NULL)
+    {
+        munmap(vm->arena, vm->arenaSize);
+    }
+    vm->arena = NULL;
+    free(vm->pages);
+    free(vm->bankBitmap);
+    free(vm->allocationBanks);
+    free(vm->decodedOps);
+    free(vm->threadedCode);
+    free(vm->fusedOps);
+    free(vm->jitBlocks);
+    free(vm->jitLengths);
+    free(vm->jitCounts);
+}
+
+// One reservation for all of guest memory. With MAP_HUGETLB it comes from the huge page pool when the pool
+// has room; with MADV_HUGEPAGE it is aligned to a huge page so the kernel can back all of it with them.
+unsigned char *mapArena(size_t size, unsigned int flags, size_t *mapped, int *hugetlb) // NULL when out of memory
+{
+    *hugetlb = 0;
+#ifdef MAP_HUGETLB
+    if (flags & VM_MEMORY_HUGETLB)
+    {
+        size_t rounded = (size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+        void *arena = mmap(NULL, rounded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (arena != MAP_FAILED)
+        {
+            *mapped = rounded;
+            *hugetlb = 1;
+            return arena;
+        }
+    }
+#endif
+    size_t alignment = (flags & VM_MEMORY_HUGE_PAGES) ? HUGE_PAGE_SIZE : HOST_PAGE_SIZE;
+    size = (size + alignment - 1) / alignment * alignment;
+    size_t reserved = size + alignment - HOST_PAGE_SIZE; // room to slide the start up to the alignment
+    unsigned char *raw = mmap(NULL, reserved, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED)
+    {
+        return NULL;
+    }
+    unsigned char *arena = (unsigned char *)(((uintptr_t)raw + alignment - 1) & ~(uintptr_t)(alignment - 1));
+    if (arena > raw)
+    {
+        munmap(raw, arena - raw);
+    }
+    if (raw + reserved > arena + size)
+    {
+        munmap(arena + size, raw + reserved - (arena + size));
+    }
+#ifdef MADV_HUGEPAGE
+    if (flags & VM_MEMORY_HUGE_PAGES)
+    {
+        madvise(arena, size, MADV_HUGEPAGE); // advice only, ordinary pages if the kernel has transparent huge pages off
+    }
+#endif
+    *mapped = size;
+    return arena;
+}
+
+int validRegion(uint32_t size)
+{
+    return size >= PAGE_SIZE && size % PAGE_SIZE == 0 && size <= VM_MAX_MEMORY_REGION;
+}
+
+void clearMemory(VM *vm, unsigned char *memory, size_t size) // large regions are zeroed by handing their pages back to the kernel
+{
+    if (size >= MADVISE_CLEAR_SIZE && !vm->hugetlb && madvise(memory, size, MADV_DONTNEED) == 0)
+    {
+        return;
+    }
+    memset(memory, 0, size);
+}
+
+void resetMachine(VM *vm) // everything but instruction and data memory, which the caller has just filled
+{
+    clearMemory(vm, vm->heapMemory, vm->heapEnd - vm->heapStart);
+    memset(vm->bankBitmap, 0, vm->bankWords * sizeof(uint64_t));
+    memset(vm->allocationBanks, 0, vm->numBanks * sizeof(uint32_t));
+    memset(&vm->heapStats, 0, sizeof(vm->heapStats));
+    memset(vm->regs, 0, sizeof(vm->regs));
+    vm->dmaSource = 0;
+    vm->dmaDestination = 0;
+    vm->dmaLength = 0;
+    vm->writePointer = 0;
+    vm->pc = 0;
+    vm->status = VM_RUNNING;
+    vm->instructionsExecuted = 0;
+    vm->traceRecorded = 0;
+    vm->traceParked = 0;
+    vm->fusionStats.dispatches = 0;
+    vm->fusionStats.retired = 0;
+    predecode(vm); // decode every instruction word once, the engines only index the table
+}
+
+int vmSetMemory(VM *vm, VMMemoryConfig config)
+{
+    if (!validRegion(config.instructionSize) || !validRegion(config.dataSize) || !validRegion(config.heapSize))
+    {
+        return -2;
+    }
+    // the new layout is built aside, so running out of memory leaves the VM as it was
+    VM staged = {.memory = config, .instSize = config.instructionSize, .dataSize = config.dataSize, .numSlots = config.instructionSize / 2};
+    unsigned int dataEnd = config.instructionSize + config.dataSize;
+    staged.heapStart = dataEnd > HEAP_START ? dataEnd : HEAP_START;
+    staged.heapEnd = staged.heapStart + config.heapSize;
+    staged.guestSpace = staged.heapEnd > MIN_GUEST_SPACE ? staged.heapEnd : MIN_GUEST_SPACE;
+    staged.numBanks = config.heapSize / HEAP_SIZE;
+    staged.bankWords = (staged.numBanks + 63) / 64;
+    size_t heapOffset = (dataEnd + HOST_PAGE_SIZE - 1) / HOST_PAGE_SIZE * HOST_PAGE_SIZE; // data memory follows instruction memory directly
+    staged.arena = mapArena(heapOffset + config.heapSize, config.flags, &staged.arenaSize, &staged.hugetlb);
+    size_t slots = staged.numSlots;
+    staged.pages = calloc(staged.guestSpace / PAGE_SIZE, sizeof(MemoryPage));
+    staged.bankBitmap = calloc(staged.bankWords, sizeof(uint64_t));
+    staged.allocationBanks = calloc(staged.numBanks, sizeof(uint32_t));
+    staged.decodedOps = calloc(slots + 1, sizeof(DecodedOp));
+    staged.threadedCode = calloc(slots + 1, sizeof(void *));
+    staged.fusedOps = calloc(slots + 1, 1);
+    staged.jitBlocks = calloc(slots, sizeof(JitBlock));
+    staged.jitLengths = calloc(slots, 1);
+    staged.jitCounts = calloc(slots, sizeof(uint16_t));
+    Profile *profile = vm->profile ? calloc(1, sizeof(Profile) + 2 * slots * sizeof(uint64_t)) : NULL;
+    if (staged.arena == NULL || staged.pages == NULL || staged.bankBitmap == NULL || staged.allocationBanks == NULL ||
+        staged.decodedOps == NULL || staged.threadedCode == NULL || staged.fusedOps == NULL || staged.jitBlocks == NULL ||
+        staged.jitLengths == NULL || staged.jitCounts == NULL || (vm->profile != NULL && profile == NULL))
+    {
+        releaseMemory(&staged);
+        free(profile);
+        return -1;
+    }
+    vmFlushOutput(vm);
+    releaseMemory(vm);
+    vm->memory = staged.memory;
+    vm->arena = staged.arena;
+    vm->arenaSize = staged.arenaSize;
+    vm->hugetlb = staged.hugetlb;
+    vm->instSize = staged.instSize;
+    vm->dataSize = staged.dataSize;
+    vm->numSlots = staged.numSlots;
+    vm->instMemory = staged.arena;
+    vm->dataMemory = staged.arena + config.instructionSize;
+    vm->guestSpace = staged.guestSpace;
+    vm->heapMemory = staged.arena + heapOffset;
+    vm->heapStart = staged.heapStart;
+    vm->heapEnd = staged.heapEnd;
+    vm->numBanks = staged.numBanks;
+    vm->bankWords = staged.bankWords;
+    vm->bankBitmap = staged.bankBitmap;
+    vm->allocationBanks = staged.allocationBanks;
+    vm->pages = staged.pages;
+    vm->decodedOps = staged.decodedOps;
+    vm->threadedCode = staged.threadedCode;
+    vm->fusedOps = staged.fusedOps;
+    vm->jitBlocks = staged.jitBlocks;
+    vm->jitLengths = staged.jitLengths;
+    vm->jitCounts = staged.jitCounts;
+    if (vm->profile != NULL)
+    {
+        free(vm->profile);
+        vm->profile = profile; // predecode() points its counters at the new slots
+    }
+    mapMemory(vm);
+    resetMachine(vm); // the fresh mapping is all zeroes, an empty image
+    return 0;
+}
+
+VMMemoryConfig vmMemory(const VM *vm)
+{
+    return vm->memory;
+}
+
+size_t vmImageSize(const VM *vm)
+{
+    return (size_t)vm->instSize + vm->dataSize;
+}
+
+VM *vmCreate(void)
+{
+    void *block;
+    if (posix_memalign(&block, 64, sizeof(VM)) != 0) // cache-line aligned, POSIX rather than C11 aligned_alloc
+    {
+        return NULL;
+    }
+    VM *vm = block;
+    memset(vm, 0, sizeof(VM));
+    vm->inputCapacity = VM_INPUT_BUFFER;
+    vm->inputBuffer = malloc(vm->inputCapacity);
+    if (vm->inputBuffer == NULL)
+    {
+        free(vm);
+        return NULL;
+    }
+    vm->input = stdin;
+    vm->inputFd = fileno(stdin);
+    vm->output = stdout;
+    vm->engine = VM_ENGINE_SWITCH;
+    vm->fusion = 1;
+    vm->jitThreshold = VM_JIT_DEFAULT_THRESHOLD;
+    vm->traceCapacity = 1 << 16;
+    if (vmSetOutputBuffer(vm, VM_DEFAULT_OUTPUT_BUFFER, VM_FLUSH_INPUT | VM_FLUSH_HALT) != 0 || vmSetMemory(vm, VM_DEFAULT_MEMORY) != 0)
+    {
+        vmDestroy(vm);
+        return NULL;
+    }
+    return vm;
+}
+
+void vmDestroy(VM *vm)
+{
+    if (vm != NULL)
+    {
+        vmFlushOutput(vm);
+        free(vm->inputBuffer);
+        free(vm->outputBuffer);
+        free(vm->traceRing);
+        free(vm->profile);
+        if (vm->jitCode != NULL)
+        {
+            munmap(vm->jitCode, JIT_CODE_SIZE);
+        }
+        aotRelease(vm);
+        free(vm->aotCacheDir);
+        releaseMemory(vm);
+        free(vm);
+    }
+}
+
+int vmLoadImage(VM *vm, const void *image, size_t size)
+{
+    if (size < vmImageSize(vm))
+    {
+        return -2;
+    }
+    vmFlushOutput(vm); // what the previous guest printed still belongs to the previous console
+    memcpy(vm->instMemory, image, vmImageSize(vm)); // data memory follows instruction memory in the arena as in the image
+    resetMachine(vm);
+    return 0;
+}
+
+int vmLoadFile(VM *vm, const char *path)
+{
+    FILE *input = fopen(path, "rb");
+    if (input == NULL)
+    {
+        return -1;
+    }
+
+    size_t size = vmImageSize(vm);
+    unsigned char *image = malloc(size);
+    size_t misRead = image != NULL ? fread(image, size, 1, input) : 0;
+    fclose(input);
+    int result = (misRead == 1) ? vmLoadImage(vm, image, size) : -2;
+    free(image);
+    return result;
+}
+
+size_t vmSnapshotSize(const VM *vm)
+{
+    return sizeof(SnapshotFile) + vmImageSize(vm) + (vm->heapEnd - vm->heapStart) + vm->bankWords * sizeof(uint64_t) +
+           vm->numBanks * sizeof(uint32_t);
+}
+
+int vmSaveSnapshot(VM *vm, const char *path)
+{
+    SnapshotFile snapshot;
+    memset(&snapshot, 0, sizeof(snapshot)); // padding bytes are deterministic
+    vmFlushOutput(vm); // output is not part of the snapshot, it has to reach the console before the copy diverges
+    snapshot.magic = SNAPSHOT_MAGIC;
+    snapshot.version = SNAPSHOT_VERSION;
+    snapshot.size = sizeof(SnapshotFile);
+    snapshot.pc = vm->pc;
+    snapshot.instructionsExecuted = vm->instructionsExecuted;
+    memcpy(snapshot.regs, vm->regs, sizeof(vm->regs));
+    snapshot.status = (vm->status == VM_SNAPSHOT_POINT || vm->status == VM_WAITING_INPUT) ? VM_RUNNING : vm->status;
+    snapshot.heapStats = vm->heapStats;
+    snapshot.instructionSize = vm->instSize;
+    snapshot.dataSize = vm->dataSize;
+    snapshot.heapSize = vm->heapEnd - vm->heapStart;
+    snapshot.dmaSource = vm->dmaSource;
+    snapshot.dmaDestination = vm->dmaDestination;
+    snapshot.dmaLength = vm->dmaLength;
+    snapshot.writePointer = vm->writePointer;
+
+    FILE *output = fopen(path, "wb");
+    if (output == NULL)
+    {
+        return -1;
+    }
+    int result = (fwrite(&snapshot, sizeof(snapshot), 1, output) == 1 && fwrite(vm->instMemory, vmImageSize(vm), 1, output) == 1 &&
+                  fwrite(vm->heapMemory, snapshot.heapSize, 1, output) == 1 &&
+                  fwrite(vm->bankBitmap, vm->bankWords * sizeof(uint64_t), 1, output) == 1 &&
+                  fwrite(vm->allocationBanks, vm->numBanks * sizeof(uint32_t), 1, output) == 1) ? 0 : -1;
+    if (fclose(output) != 0)
+    {
+        result = -1;
+    }
+    return result;
+}
+
+// The heap bookkeeping of a snapshot has to be something heapAllocate() and heapFree() could have produced:
+// every allocation inside the heap, no two overlapping, and exactly the banks they cover set in the bitmap.
+// heapFree() trusts these lengths, so a bad one would write past the bitmap.
+int validSnapshotHeap(const unsigned char *bitmap, const unsigned char *lengths, uint32_t banks)
+{
+    uint32_t coveredEnd = 0; // first bank past the last allocation seen
+    for (uint32_t bank = 0; bank < (banks + 63) / 64 * 64; bank++)
+    {
+        uint64_t word;
+        memcpy(&word, bitmap + bank / 64 * sizeof(uint64_t), sizeof(word)); // the caller's buffer need not be aligned
+        uint32_t length = 0;
+        if (bank < banks)
+        {
+            memcpy(&length, lengths + bank * sizeof(uint32_t), sizeof(length));
+        }
+        if (length != 0)
+        {
+            if (bank < coveredEnd || length > banks - bank)
+            {
+                return 0;
+            }
+            coveredEnd = bank + length;
+        }
+        if ((int)(word >> (bank % 64) & 1) != (bank < coveredEnd))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int vmRestoreSnapshot(VM *vm, const void *data, size_t size)
+{
+    const SnapshotFile *snapshot = data;
+    if (size < sizeof(SnapshotFile) || snapshot->magic != SNAPSHOT_MAGIC || snapshot->version != SNAPSHOT_VERSION ||
+        snapshot->size != sizeof(SnapshotFile) || !validRegion(snapshot->instructionSize) || !validRegion(snapshot->dataSize) ||
+        !validRegion(snapshot->heapSize) || snapshot->pc < 0 || (uint32_t)snapshot->pc > snapshot->instructionSize || (snapshot->pc & 1) ||
+        snapshot->status > VM_SNAPSHOT_POINT)
+    {
+        return -2;
+    }
+    // everything is checked against the file before the VM gives up its current state
+    uint32_t banks = snapshot->heapSize / HEAP_SIZE;
+    size_t heapOffset = sizeof(SnapshotFile) + (size_t)snapshot->instructionSize + snapshot->dataSize;
+    size_t bitmapOffset = heapOffset + snapshot->heapSize;
+    size_t lengthsOffset = bitmapOffset + (banks + 63) / 64 * sizeof(uint64_t);
+    if (size < lengthsOffset + banks * sizeof(uint32_t) ||
+        !validSnapshotHeap((const unsigned char *)data + bitmapOffset, (const unsigned char *)data + lengthsOffset, banks))
+    {
+        return -2;
+    }
+    if (snapshot->instructionSize != (uint32_t)vm->instSize || snapshot->dataSize != (uint32_t)vm->dataSize ||
+        snapshot->heapSize != vm->heapEnd - vm->heapStart)
+    {
+        VMMemoryConfig layout = {snapshot->instructionSize, snapshot->dataSize, snapshot->heapSize, vm->memory.flags};
+        int result = vmSetMemory(vm, layout);
+        if (result != 0)
+        {
+            return result;
+        }
+    }
+    vmFlushOutput(vm);
+    const unsigned char *contents = (const unsigned char *)(snapshot + 1);
+    memcpy(vm->instMemory, contents, vmImageSize(vm));
+    contents += vmImageSize(vm);
+    memcpy(vm->heapMemory, contents, snapshot->heapSize);
+    contents += snapshot->heapSize;
+    memcpy(vm->bankBitmap, contents, vm->bankWords * sizeof(uint64_t));
+    contents += vm->bankWords * sizeof(uint64_t);
+    memcpy(vm->allocationBanks, contents, vm->numBanks * sizeof(uint32_t));
+    vm->pc = snapshot->pc;
+    vm->instructionsExecuted = snapshot->instructionsExecuted;
+    memcpy(vm->regs, snapshot->regs, sizeof(vm->regs));
+    vm->status = snapshot->status;
+    vm->heapStats = snapshot->heapStats;
+    vm->dmaSource = snapshot->dmaSource;
+    vm->dmaDestination = snapshot->dmaDestination;
+    vm->dmaLength = snapshot->dmaLength;
+    vm->writePointer = snapshot->writePointer;
+    vm->traceRecorded = 0;
+    vm->traceParked = 0;
+    vm->fusionStats.dispatches = 0;
+    vm->fusionStats.retired = 0;
+    predecode(vm); // the decoded table is derived state and never stored
+    return 0;
+}
+
+int vmLoadSnapshot(VM *vm, const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(SnapshotFile))
+    {
+        close(fd);
+        return -2;
+    }
+    void *mapped = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0); // shared page cache across every run of the same snapshot
+    close(fd);
+    if (mapped == MAP_FAILED)
+    {
+        return -1;
+    }
+    int result = vmRestoreSnapshot(vm, mapped, info.st_size);
+    munmap(mapped, info.st_size);
+    return result;
+}
+
+void vmSetSnapshotTrigger(VM *vm, int enabled)
+{
+    vm->snapshotTrigger = enabled;
+}
+
+void vmSetConsole(VM *vm, FILE *input, FILE *output)
+{
+    vmFlushOutput(vm);
+    vm->input = input;
+    vm->inputFd = fileno(input);
+    vm->inputStart = vm->inputEnd = 0; // read-ahead from the old stream is dropped
+    vm->inputEof = 0;
+    vm->output = output;
+}
+
+void vmSetInputNonBlocking(VM *vm, int nonBlocking)
+{
+    vm->inputNonBlocking = nonBlocking;
+}
+
+int vmInputFd(const VM *vm)
+{
+    return vm->inputFd;
+}
+
+void vmSetEngine(VM *vm, VMEngine engine)
+{
+    vm->engine = engine;
+}
+
+void vmSetFusion(VM *vm, int enabled)
+{
+    vm->fusion = enabled;
+    vm->threadedReady = 0;
+}
+
+int vmSetAotCache(VM *vm, const char *directory)
+{
+    char *copy = NULL;
+    if (directory != NULL && (copy = strdup(directory)) == NULL)
+    {
+        return -1;
+    }
+    free(vm->aotCacheDir);
+    vm->aotCacheDir = copy;
+    aotRelease(vm);
+    return 0;
+}
+
+void vmSetJitThreshold(VM *vm, unsigned int threshold)
+{
+    vm->jitThreshold = (threshold == 0) ? 1 : (threshold >= 0xFFFF) ? 0xFFFE : threshold;
+}
+
+JitStats vmJitStatistics(const VM *vm)
+{
+    return vm->jitStats;
+}
+
+void vmPrintJitStatistics(const VM *vm, FILE *output)
+{
+    const JitStats *stats = &vm->jitStats;
+    fprintf(output, "jit: %u blocks compiled into %zu bytes\n", stats->blocks, stats->codeBytes);
+    fprintf(output, "jit: %llu of %llu instructions retired in compiled code, %llu bailouts to the interpreter\n",
+            (unsigned long long)stats->retired, (unsigned long long)vm->instructionsExecuted, (unsigned long long)stats->bails);
+}
+
+// The profiled engine is a separate loop like the traced one: every instruction bumps its slot's counter
+// and, when it jumped, the slot's taken counter. Per-opcode totals and hot blocks are worked out from the
+// slot counters when the report is written, so nothing else is counted while the guest runs.
+uint64_t runProfiled(VM *vm, uint64_t remaining)
+{
+    Profile *profile = vm->profile;
+    while (remaining && vm->status == VM_RUNNING)
+    {
+        int slot = vm->pc >> 1;
+        const DecodedOp *op = &vm->decodedOps[slot];
+        execute(vm, op);
+        remaining--;
+        if (vm->status == VM_WAITING_INPUT) // parked, the read runs again on the next vmRun
+        {
+            break;
+        }
+        profile->executed[slot]++;
+        profile->taken[slot] += (vm->pc != slot * 2 + opLength(op));
+    }
+    return remaining;
+}
+
+int vmSetProfile(VM *vm, int enabled)
+{
+    free(vm->profile);
+    vm->profile = NULL;
+    if (enabled && (vm->profile = calloc(1, sizeof(Profile) + 2 * vm->numSlots * sizeof(uint64_t))) == NULL)
+    {
+        return -1;
+    }
+    if (enabled)
+    {
+        vm->profile->executed = vm->profile->slots;
+        vm->profile->taken = vm->profile->slots + vm->numSlots;
+    }
+    return 0;
+}
+
+const char *deviceName(int address)
+{
+    switch (address)
+    {
+    case 2048:
+        return "console write char";
+    case 2052:
+        return "console write int";
+    case 2056:
+        return "console write uint";
+    case 2060:
+        return "halt";
+    case 2066:
+        return "console read char";
+    case 2070:
+        return "console read int";
+    case 2080:
+        return "dump pc";
+    case 2084:
+        return "dump registers";
+    case 2088:
+        return "dump memory word";
+    case 2096:
+        return "malloc";
+    case 2100:
+        return "free";
+    case VM_SNAPSHOT_DEVICE:
+        return "snapshot point";
+    case 2112:
+        return "dma source";
+    case 2116:
+        return "dma destination";
+    case 2120:
+        return "dma length";
+    case 2124:
+        return "dma command";
+    case 2128:
+        return "console block address";
+    case 2132:
+        return "console block write";
+    default:
+        return "unknown";
+    }
+}
+
+typedef struct
+{
+    int start; // first slot
+    int last;  // slot of the last instruction
+    int end;   // slot just past it
+    uint64_t retired;
+} ProfileBlock;
+
+int compareProfileBlocks(const void *a, const void *b) // most retired instructions first
+{
+    uint64_t left = ((const ProfileBlock *)a)->retired;
+    uint64_t right = ((const ProfileBlock *)b)->retired;
+    return (left < right) - (left > right);
+}
+
+int profileBlocks(const VM *vm, ProfileBlock *blocks) // basic blocks along a linear sweep of the image, hottest first, -1 when out of memory
+{
+    uint8_t *leader = calloc(vm->numSlots + 1, 1);
+    if (leader == NULL)
+    {
+        return -1;
+    }
+    leader[0] = 1;
+    for (int i = 0; i < vm->numSlots; i += opLength(&vm->decodedOps[i]) / 2)
+    {
+        const DecodedOp *op = &vm->decodedOps[i];
+        if ((op->handler >= OP_BEQ && op->handler <= OP_BGEU) || op->handler == OP_JAL) // in range, far branches were split off at load time
+        {
+            leader[(i * 2 + op->imm) / 2] = 1;
+        }
+        if ((op->handler >= OP_BEQ && op->handler <= OP_BGEU) || op->handler == OP_JAL || op->handler == OP_JALR || op->handler >= OP_FAR_BRANCH)
+        {
+            leader[i + opLength(op) / 2] = 1;
+        }
+    }
+    leader[vm->numSlots] = 1;
+    int count = 0;
+    for (int i = 0; i < vm->numSlots; count++)
+    {
+        blocks[count] = (ProfileBlock){i, i, i, 0};
+        do
+        {
+            blocks[count].last = i;
+            blocks[count].retired += vm->profile->executed[i];
+            i += opLength(&vm->decodedOps[i]) / 2;
+        } while (!leader[i]);
+        blocks[count].end = i;
+    }
+    free(leader);
+    qsort(blocks, count, sizeof(ProfileBlock), compareProfileBlocks);
+    return count;
+}
+
+int vmWriteProfile(const VM *vm, FILE *output, int json)
+{
+    const Profile *profile = vm->profile;
+    if (profile == NULL)
+    {
+        return -1;
+    }
+    uint64_t total = 0;
+    uint64_t perOpcode[NUM_OP_HANDLERS] = {0};
+    for (int i = 0; i < vm->numSlots; i++)
+    {
+        const DecodedOp *op = &vm->decodedOps[i];
+        total += profile->executed[i];
+        perOpcode[op->handler == OP_FAR_BRANCH ? op->rd : op->handler] += profile->executed[i];
+    }
+    ProfileBlock *blocks = malloc(vm->numSlots * sizeof(ProfileBlock));
+    int blockCount = blocks != NULL ? profileBlocks(vm, blocks) : -1;
+    if (blockCount < 0)
+    {
+        free(blocks);
+        return -1;
+    }
+    char text[64];
+
+    fprintf(output, json ? "{\n  \"instructions\": %llu,\n  \"opcodes\": {" : "profile: %llu instructions\nopcodes:\n", (unsigned long long)total);
+    const char *separator = "";
+    for (int handler = 0; handler < NUM_OP_HANDLERS; handler++)
+    {
+        if (perOpcode[handler] == 0)
+        {
+            continue;
+        }
+        if (json)
+        {
+            fprintf(output, "%s\"%s\": %llu", separator, opNames[handler], (unsigned long long)perOpcode[handler]);
+            separator = ", ";
+        }
+        else
+        {
+            fprintf(output, "  %-16s %14llu %6.2f%%\n", opNames[handler], (unsigned long long)perOpcode[handler], 100.0 * perOpcode[handler] / total);
+        }
+    }
+
+    fprintf(output, json ? "},\n  \"devices\": [" : "devices:\n");
+    separator = "";
+    for (int offset = 0; offset < PAGE_SIZE; offset++)
+    {
+        uint64_t loads = profile->deviceLoads[offset];
+        uint64_t stores = profile->deviceStores[offset];
+        if (loads == 0 && stores == 0)
+        {
+            continue;
+        }
+        int address = DEVICE_START + offset;
+        if (json)
+        {
+            fprintf(output, "%s\n    {\"address\": %d, \"name\": \"%s\", \"loads\": %llu, \"stores\": %llu}", separator, address, deviceName(address),
+                    (unsigned long long)loads, (unsigned long long)stores);
+            separator = ",";
+        }
+        else
+        {
+            fprintf(output, "  0x%04x %-20s %12llu loads %12llu stores\n", address, deviceName(address), (unsigned long long)loads, (unsigned long long)stores);
+        }
+    }
+
+    fprintf(output, json ? "\n  ],\n  \"branches\": [" : "branches:\n");
+    separator = "";
+    for (int i = 0; i < vm->numSlots; i++)
+    {
+        const DecodedOp *op = &vm->decodedOps[i];
+        int handler = op->handler == OP_FAR_BRANCH ? op->rd : op->handler;
+        if (handler < OP_BEQ || handler > OP_BGEU || profile->executed[i] == 0)
+        {
+            continue;
+        }
+        uint64_t taken = profile->taken[i];
+        uint64_t notTaken = profile->executed[i] - taken;
+        disassemble(vm, i * 2, text, sizeof(text));
+        if (json)
+        {
+            fprintf(output, "%s\n    {\"pc\": %d, \"text\": \"%s\", \"taken\": %llu, \"notTaken\": %llu}", separator, i * 2, text,
+                    (unsigned long long)taken, (unsigned long long)notTaken);
+            separator = ",";
+        }
+        else
+        {
+            fprintf(output, "  0x%03x %-28s %12llu taken %12llu not taken\n", i * 2, text, (unsigned long long)taken, (unsigned long long)notTaken);
+        }
+    }
+
+    fprintf(output, json ? "\n  ],\n  \"hotBlocks\": [" : "hot blocks:\n");
+    separator = "";
+    for (int b = 0; b < blockCount && b < PROFILE_HOT_BLOCKS && blocks[b].retired != 0; b++)
+    {
+        const ProfileBlock *block = &blocks[b];
+        uint64_t entries = profile->executed[block->start];
+        if (json)
+        {
+            fprintf(output, "%s\n    {\"start\": %d, \"end\": %d, \"entries\": %llu, \"instructions\": %llu, \"code\": [", separator, block->start * 2,
+                    block->end * 2, (unsigned long long)entries, (unsigned long long)block->retired);
+        }
+        else
+        {
+            fprintf(output, "  0x%03x-0x%03x %12llu entries %14llu instructions %6.2f%%\n", block->start * 2, block->last * 2,
+                    (unsigned long long)entries, (unsigned long long)block->retired, 100.0 * block->retired / total);
+        }
+        for (int i = block->start; i < block->end; i += opLength(&vm->decodedOps[i]) / 2)
+        {
+            disassemble(vm, i * 2, text, sizeof(text));
+            if (json)
+            {
+                fprintf(output, "%s{\"pc\": %d, \"count\": %llu, \"text\": \"%s\"}", i == block->start ? "" : ", ", i * 2,
+                        (unsigned long long)profile->executed[i], text);
+            }
+            else
+            {
+                fprintf(output, "    0x%03x %12llu  %s\n", i * 2, (unsigned long long)profile->executed[i], text);
+            }
+        }
+        if (json)
+        {
+            fprintf(output, "]}");
+            separator = ",";
+        }
+    }
+    if (json)
+    {
+        fprintf(output, "\n  ]\n}\n");
+    }
+    free(blocks);
+    return ferror(output) ? -1 : 0;
+}
+
+FusionStats vmFusionStatistics(const VM *vm)
+{
+    return vm->fusionStats;
+}
+
+void vmPrintFusionStatistics(const VM *vm, FILE *output)
+{
+    const FusionStats *stats = &vm->fusionStats;
+    unsigned int perRule[NUM_FUSED_OPS] = {0};
+    int instructions = 0;
+    for (int i = 0; i < vm->numSlots; i += opLength(&vm->decodedOps[i]) / 2) // the same sweep fuseOps() looked along
+    {
+        perRule[vm->fusedOps[i]]++;
+        instructions++;
+    }
+    fprintf(output, "fusion: %u sites covering %u of %d instructions\n", stats->sites, stats->instructions, instructions);
+    for (int rule = FUSE_NONE + 1; rule < NUM_FUSED_OPS; rule++)
+    {
+        if (perRule[rule] != 0)
+        {
+            fprintf(output, "fusion: %-12s %u sites\n", fusionRules[rule].name, perRule[rule]);
+        }
+    }
+    uint64_t dispatches = vm->instructionsExecuted - stats->retired + stats->dispatches;
+    fprintf(output, "fusion: %llu of %llu instructions retired fused, %.3f dispatches per instruction\n",
+            (unsigned long long)stats->retired, (unsigned long long)vm->instructionsExecuted,
+            vm->instructionsExecuted ? (double)dispatches / vm->instructionsExecuted : 0.0);
+}
+
+VMStatus vmRun(VM *vm, uint64_t maxInstructions)
+{
+    uint64_t remaining;
+    if (vm->status == VM_WAITING_INPUT || vm->status == VM_SNAPSHOT_POINT) // retry the parked console read, or carry on past the snapshot point
+    {
+        vm->status = VM_RUNNING;
+    }
+#if TRACE_SUPPORT
+    if (vm->traceLevel != TRACE_OFF)
+    {
+        remaining = runTraced(vm, maxInstructions);
+    }
+    else
+#endif
+    if (vm->profile != NULL)
+    {
+        remaining = runProfiled(vm, maxInstructions);
+    }
+    else if (vm->engine == VM_ENGINE_THREADED)
+    {
+        remaining = runThreaded(vm, maxInstructions);
+    }
+    else if (vm->engine == VM_ENGINE_JIT)
+    {
+        remaining = runJit(vm, maxInstructions);
+    }
+    else if (vm->engine == VM_ENGINE_AOT)
+    {
+        remaining = runAot(vm, maxInstructions);
+    }
+    else
+    {
+        remaining = runSwitch(vm, maxInstructions);
+    }
+    vm->instructionsExecuted += maxInstructions - remaining;
+    if (vm->status != VM_RUNNING && vm->status != VM_WAITING_INPUT && vm->status != VM_SNAPSHOT_POINT && (vm->flushPolicy & VM_FLUSH_HALT))
+    {
+        vmFlushOutput(vm);
+    }
+    return vm->status;
+}
+
+VMStatus vmStatus(const VM *vm)
+{
+    return vm->status;
+}
+
+int vmPc(const VM *vm)
+{
+    return vm->pc;
+}
+
+int vmRegister(const VM *vm, int index)
+{
+    return (index >= 0 && index < NUM_REGS) ? vm->regs[index] : 0;
+}
+
+uint64_t vmInstructionsExecuted(const VM *vm)
+{
+    return vm->instructionsExecuted;
+}
+
+const char *vmStatusName(VMStatus status)
+{
+    static const char *names[] = {"running", "halted", "illegal operation", "not implemented", "end of program", "waiting for input", "snapshot point"};
+    return (status >= VM_RUNNING && status <= VM_SNAPSHOT_POINT) ? names[status] : "unknown";
+}
+
+// Ready guests sit in a ring for round-robin and in a binary heap for priority scheduling, both in the
+// same array. Thieves take guests off the back of that array: the newest arrivals of a ring, or heap
+// leaves, which never breaks the heap. Parked guests stay with the scheduler that parked them.
+typedef struct
+{
+    VM *vm;
+    int priority;
+    uint64_t order; // when the guest became ready, earlier runs first among equal priorities
+} ScheduledGuest;
+
+struct VMScheduler
+{
+    pthread_mutex_t lock; // guards the ready queue, the only part other schedulers touch
+    VMSchedulePolicy policy;
+    uint64_t quantum;
+    ScheduledGuest *ready;
+    int readyHead; // ring start, always 0 for the heap
+    int readyCount;
+    int readyCapacity;
+    uint64_t nextOrder;
+    ScheduledGuest *parked; // waiting for input, parkedFds[i] belongs to parked[i]
+    struct pollfd *parkedFds;
+    int parkedCount;
+    int parkedCapacity;
+    VMScheduler **group; // schedulers to steal from, this one included
+    int groupSize;
+    VMGuestFinished finished;
+    void *finishedContext;
+    VMSchedulerStats stats;
+};
+
+VMScheduler *vmSchedulerCreate(VMSchedulePolicy policy, uint64_t quantum)
+{
+    VMScheduler *scheduler = calloc(1, sizeof(VMScheduler));
+    if (scheduler == NULL)
+    {
+        return NULL;
+    }
+    pthread_mutex_init(&scheduler->lock, NULL);
+    scheduler->policy = policy;
+    scheduler->quantum = quantum ? quantum : VM_DEFAULT_QUANTUM;
+    return scheduler;
+}
+
+void vmSchedulerDestroy(VMScheduler *scheduler)
+{
+    if (scheduler != NULL)
+    {
+        pthread_mutex_destroy(&scheduler->lock);
+        free(scheduler->ready);
+        free(scheduler->parked);
+        free(scheduler->parkedFds);
+        free(scheduler);
+    }
+}
+
+void vmSchedulerOnFinished(VMScheduler *scheduler, VMGuestFinished finished, void *context)
+{
+    scheduler->finished = finished;
+    scheduler->finishedContext = context;
+}
+
+void vmSchedulerGroup(VMScheduler **schedulers, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        schedulers[i]->group = schedulers;
+        schedulers[i]->groupSize = count;
+    }
+}
+
+VMSchedulerStats vmSchedulerStatistics(const VMScheduler *scheduler)
+{
+    return scheduler->stats;
+}
+
+ScheduledGuest *readySlot(VMScheduler *scheduler, int index)
+{
+    return &scheduler->ready[(scheduler->readyHead + index) % scheduler->readyCapacity];
+}
+
+int runsBefore(const ScheduledGuest *a, const ScheduledGuest *b)
+{
+    return a->priority != b->priority ? a->priority > b->priority : a->order < b->order;
+}
+
+int readyPush(VMScheduler *scheduler, ScheduledGuest guest) // lock held, -1 when out of memory
+{
+    if (scheduler->readyCount == scheduler->readyCapacity) // grow and unwrap the ring
+    {
+        int capacity = scheduler->readyCapacity ? scheduler->readyCapacity * 2 : 64;
+        ScheduledGuest *ready = malloc(capacity * sizeof(ScheduledGuest));
+        if (ready == NULL)
+        {
+            return -1;
+        }
+        for (int i = 0; i < scheduler->readyCount; i++)
+        {
+            ready[i] = *readySlot(scheduler, i);
+        }
+        free(scheduler->ready);
+        scheduler->ready = ready;
+        scheduler->readyHead = 0;
+        scheduler->readyCapacity = capacity;
+    }
+    guest.order = scheduler->nextOrder++;
+    int slot = scheduler->readyCount++;
+    if (scheduler->policy == VM_SCHEDULE_ROUND_ROBIN)
+    {
+        *readySlot(scheduler, slot) = guest;
+        return 0;
+    }
+    for (; slot > 0 && runsBefore(&guest, &scheduler->ready[(slot - 1) / 2]); slot = (slot - 1) / 2) // sift up
+    {
+        scheduler->ready[slot] = scheduler->ready[(slot - 1) / 2];
+    }
+    scheduler->ready[slot] = guest;
+    return 0;
+}
+
+int readyPop(VMScheduler *scheduler, ScheduledGuest *guest) // lock held, 0 when nothing is ready
+{
+    if (scheduler->readyCount == 0)
+    {
+        return 0;
+    }
+    if (scheduler->policy == VM_SCHEDULE_ROUND_ROBIN)
+    {
+        *guest = *readySlot(scheduler, 0);
+        scheduler->readyHead = (scheduler->readyHead + 1) % scheduler->readyCapacity;
+        scheduler->readyCount--;
+        return 1;
+    }
+    *guest = scheduler->ready[0];
+    ScheduledGuest last = scheduler->ready[--scheduler->readyCount];
+    int slot = 0;
+    for (;;) // sift the last leaf down from the root
+    {
+        int child = slot * 2 + 1;
+        if (child >= scheduler->readyCount)
+        {
+            break;
+        }
+        if (child + 1 < scheduler->readyCount && runsBefore(&scheduler->ready[child + 1], &scheduler->ready[child]))
+        {
+            child++;
+        }
+        if (!runsBefore(&scheduler->ready[child], &last))
+        {
+            break;
+        }
+        scheduler->ready[slot] = scheduler->ready[child];
+        slot = child;
+    }
+    scheduler->ready[slot] = last;
+    return 1;
+}
+
+int schedulerSteal(VMScheduler *scheduler, ScheduledGuest *guest) // half of the first peer with ready guests, 0 when all are dry
+{
+    ScheduledGuest loot[SCHEDULER_STEAL_MAX];
+    int self = 0;
+    while (self < scheduler->groupSize && scheduler->group[self] != scheduler)
+    {
+        self++;
+    }
+    for (int i = 1; i < scheduler->groupSize; i++)
+    {
+        VMScheduler *victim = scheduler->group[(self + i) % scheduler->groupSize];
+        pthread_mutex_lock(&victim->lock);
+        int taken = (victim->readyCount + 1) / 2;
+        taken = taken > SCHEDULER_STEAL_MAX ? SCHEDULER_STEAL_MAX : taken;
+        for (int t = 0; t < taken; t++)
+        {
+            loot[t] = *readySlot(victim, --victim->readyCount);
+        }
+        pthread_mutex_unlock(&victim->lock);
+        if (taken == 0)
+        {
+            continue;
+        }
+        scheduler->stats.steals += taken;
+        pthread_mutex_lock(&scheduler->lock);
+        for (int t = 1; t < taken; t++)
+        {
+            readyPush(scheduler, loot[t]); // a failed push only happens out of memory, when running the guest later hardly matters
+        }
+        pthread_mutex_unlock(&scheduler->lock);
+        *guest = loot[0];
+        return 1;
+    }
+    return 0;
+}
+
+int schedulerPark(VMScheduler *scheduler, ScheduledGuest guest)
+{
+    if (scheduler->parkedCount == scheduler->parkedCapacity)
+    {
+        int capacity = scheduler->parkedCapacity ? scheduler->parkedCapacity * 2 : 64;
+        ScheduledGuest *parked = realloc(scheduler->parked, capacity * sizeof(ScheduledGuest));
+        if (parked == NULL)
+        {
+            return -1;
+        }
+        scheduler->parked = parked;
+        struct pollfd *fds = realloc(scheduler->parkedFds, capacity * sizeof(struct pollfd));
+        if (fds == NULL)
+        {
+            return -1;
+        }
+        scheduler->parkedFds = fds;
+        scheduler->parkedCapacity = capacity;
+    }
+    scheduler->parked[scheduler->parkedCount] = guest;
+    scheduler->parkedFds[scheduler->parkedCount++] = (struct pollfd){vmInputFd(guest.vm), POLLIN, 0};
+    scheduler->stats.parks++;
+    return 0;
+}
+
+void schedulerWake(VMScheduler *scheduler, int timeout) // parked guests whose input is ready go back on the ready queue
+{
+    if (poll(scheduler->parkedFds, scheduler->parkedCount, timeout) <= 0)
+    {
+        return;
+    }
+    pthread_mutex_lock(&scheduler->lock);
+    for (int i = scheduler->parkedCount - 1; i >= 0; i--)
+    {
+        if (scheduler->parkedFds[i].revents != 0) // POLLHUP and POLLERR too, the guest then sees end of input
+        {
+            readyPush(scheduler, scheduler->parked[i]);
+            scheduler->parked[i] = scheduler->parked[--scheduler->parkedCount];
+            scheduler->parkedFds[i] = scheduler->parkedFds[scheduler->parkedCount];
+        }
+    }
+    pthread_mutex_unlock(&scheduler->lock);
+}
+
+int vmSchedulerAdd(VMScheduler *scheduler, VM *vm, int priority)
+{
+    vmSetInputNonBlocking(vm, 1); // a blocking read would stall every guest on the thread
+    pthread_mutex_lock(&scheduler->lock);
+    int result = readyPush(scheduler, (ScheduledGuest){vm, priority, 0});
+    pthread_mutex_unlock(&scheduler->lock);
+    return result;
+}
+
+int vmSchedulerRun(VMScheduler *scheduler)
+{
+    int finished = 0;
+    for (;;)
+    {
+        ScheduledGuest guest;
+        pthread_mutex_lock(&scheduler->lock);
+        int found = readyPop(scheduler, &guest);
+        pthread_mutex_unlock(&scheduler->lock);
+        if (!found && !schedulerSteal(scheduler, &guest))
+        {
+            if (scheduler->parkedCount == 0)
+            {
+                break;
+            }
+            schedulerWake(scheduler, scheduler->groupSize > 1 ? SCHEDULER_IDLE_POLL_MS : -1); // alone, nothing can arrive but input
+            continue;
+        }
+
+        VMStatus status = vmRun(guest.vm, scheduler->quantum);
+        scheduler->stats.quanta++;
+        if (status == VM_RUNNING)
+        {
+            pthread_mutex_lock(&scheduler->lock);
+            readyPush(scheduler, guest);
+            pthread_mutex_unlock(&scheduler->lock);
+        }
+        else if (status == VM_WAITING_INPUT)
+        {
+            schedulerPark(scheduler, guest);
+        }
+        else // halted, failed or at a snapshot point: the owner decides what happens next
+        {
+            finished++;
+            scheduler->stats.finished++;
+            if (scheduler->finished != NULL)
+            {
+                scheduler->finished(guest.vm, status, scheduler->finishedContext);
+            }
+        }
+        if (scheduler->parkedCount != 0 && scheduler->stats.quanta % SCHEDULER_POLL_INTERVAL == 0) // runnable guests must not starve parked ones
+        {
+            schedulerWake(scheduler, 0);
+        }
+    }
+    return finished;
+}
+
+#ifndef RISKXVII_NO_MAIN // define to link the VM into another program as a library
+double secondsNow()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+typedef struct
+{
+    char *imagePath;
+    char *outputPath; // the guest's console output, <image>.out or <output dir>/<image name>.out
+    int loadError;
+    VMStatus status;
+    uint64_t instructions;
+    double seconds;
+} BatchJob;
+
+typedef struct // one per worker, the owner takes jobs from the bottom and thieves steal from the top
+{
+    pthread_mutex_t lock;
+    int *jobs;
+    int top;
+    int bottom;
+} WorkDeque;
+
+typedef struct // the per-guest command line settings, applied the same way to a single guest and to every batch worker
+{
+    VMEngine engine;
+    VMMemoryConfig memory;
+    int fusion;
+    unsigned int jitThreshold;
+    size_t outputBuffer;
+    unsigned int flushPolicy;
+    int profile;
+    const char *aotCache; // NULL for $RISKXVII_AOT_CACHE or the user's cache directory
+} GuestOptions;
+
+int configureGuest(VM *vm, const GuestOptions *options) // before loading, since a new memory layout resets the machine; -1 when out of memory
+{
+    if (vmSetMemory(vm, options->memory) != 0 || vmSetOutputBuffer(vm, options->outputBuffer, options->flushPolicy) != 0 ||
+        vmSetProfile(vm, options->profile) != 0 || vmSetAotCache(vm, options->aotCache) != 0)
+    {
+        return -1;
+    }
+    vmSetEngine(vm, options->engine);
+    vmSetFusion(vm, options->fusion);
+    vmSetJitThreshold(vm, options->jitThreshold);
+    return 0;
+}
+
+typedef struct
+{
+    BatchJob *jobs;
+    int jobCount;
+    WorkDeque *deques;
+    int workerCount;
+    GuestOptions options; // profile writes <output>.profile and <output>.profile.json for every job
+} BatchRunner;
+
+typedef struct
+{
+    BatchRunner *runner;
+    int id;
+} BatchWorker;
+
+int takeJob(WorkDeque *deque, int fromBottom) // -1 when the deque is empty
+{
+    int job = -1;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->top < deque->bottom)
+    {
+        job = fromBottom ? deque->jobs[--deque->bottom] : deque->jobs[deque->top++];
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return job;
+}
+
+int writeProfileFiles(const VM *vm, const char *path) // text report at path, JSON at path.json
+{
+    size_t length = strlen(path) + 6;
+    char *jsonPath = malloc(length);
+    snprintf(jsonPath, length, "%s.json", path);
+    int result = -1;
+    FILE *text = fopen(path, "w");
+    FILE *json = fopen(jsonPath, "w");
+    if (text != NULL && json != NULL)
+    {
+        result = (vmWriteProfile(vm, text, 0) == 0 && vmWriteProfile(vm, json, 1) == 0) ? 0 : -1;
+    }
+    if (text != NULL && fclose(text) != 0)
+    {
+        result = -1;
+    }
+    if (json != NULL && fclose(json) != 0)
+    {
+        result = -1;
+    }
+    free(jsonPath);
+    return result;
+}
+
+void runBatchJob(VM *vm, BatchRunner *runner, BatchJob *job)
+{
+    double start = secondsNow();
+    size_t length = strlen(job->imagePath);
+    int isSnapshot = length > 5 && strcmp(job->imagePath + length - 5, ".snap") == 0; // warm start from a snapshot instead of pc 0
+    VMMemoryConfig current = vmMemory(vm);
+    VMMemoryConfig wanted = runner->options.memory;
+    if (!isSnapshot && (current.instructionSize != wanted.instructionSize || current.dataSize != wanted.dataSize ||
+                        current.heapSize != wanted.heapSize || current.flags != wanted.flags))
+    {
+        if (vmSetMemory(vm, wanted) != 0) // an earlier snapshot job left its own layout on this worker's VM
+        {
+            job->loadError = -1;
+            return;
+        }
+    }
+    job->loadError = isSnapshot ? vmLoadSnapshot(vm, job->imagePath) : vmLoadFile(vm, job->imagePath);
+    if (job->loadError != 0)
+    {
+        return;
+    }
+
+    char *inputPath = malloc(length + 4);
+    snprintf(inputPath, length + 4, "%s.in", job->imagePath); // optional console input next to the image
+    FILE *input = fopen(inputPath, "r");
+    free(inputPath);
+    if (input == NULL)
+    {
+        input = fopen("/dev/null", "r");
+    }
+    FILE *output = fopen(job->outputPath, "w");
+    if (input == NULL || output == NULL)
+    {
+        job->loadError = -1;
+        if (input != NULL)
+        {
+            fclose(input);
+        }
+        if (output != NULL)
+        {
+            fclose(output);
+        }
+        return;
+    }
+
+    vmSetConsole(vm, input, output);
+    job->status = vmRun(vm, VM_RUN_FOREVER);
+    vmFlushOutput(vm); // whatever the flush policy left buffered belongs in this job's file
+    job->instructions = vmInstructionsExecuted(vm);
+    if (runner->options.profile)
+    {
+        size_t outputLength = strlen(job->outputPath);
+        char *profilePath = malloc(outputLength + 5);
+        snprintf(profilePath, outputLength + 5, "%.*s.profile", (int)(outputLength - 4), job->outputPath); // x.out becomes x.profile
+        writeProfileFiles(vm, profilePath);
+        free(profilePath);
+    }
+    fclose(input);
+    fclose(output);
+    job->seconds = secondsNow() - start;
+}
+
+void *batchWorker(void *argument)
+{
+    BatchWorker *worker = argument;
+    BatchRunner *runner = worker->runner;
+    VM *vm = vmCreate(); // reused for every job this worker runs, loading resets it
+    if (vm == NULL || configureGuest(vm, &runner->options) != 0)
+    {
+        vmDestroy(vm);
+        return NULL;
+    }
+    for (;;)
+    {
+        int job = takeJob(&runner->deques[worker->id], 1);
+        for (int i = 1; job < 0 && i < runner->workerCount; i++) // own deque is empty, steal from the others in turn
+        {
+            job = takeJob(&runner->deques[(worker->id + i) % runner->workerCount], 0);
+        }
+        if (job < 0) // every deque is empty and jobs never spawn new ones, so the batch is done
+        {
+            break;
+        }
+        runBatchJob(vm, runner, &runner->jobs[job]);
+    }
+    vmDestroy(vm);
+    return NULL;
+}
+
+int compareStrings(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+int collectBatchImages(const char *source, char ***images) // every .mi and .snap file of a directory, or every line of a manifest
+{
+    int count = 0;
+    int capacity = 64;
+    *images = malloc(capacity * sizeof(char *));
+    DIR *directory = opendir(source);
+    if (directory != NULL)
+    {
+        struct dirent *entry;
+        while ((entry = readdir(directory)) != NULL)
+        {
+            size_t length = strlen(entry->d_name);
+            if (!(length > 3 && strcmp(entry->d_name + length - 3, ".mi") == 0) && !(length > 5 && strcmp(entry->d_name + length - 5, ".snap") == 0))
+            {
+                continue;
+            }
+            if (count == capacity)
+            {
+                capacity *= 2;
+                *images = realloc(*images, capacity * sizeof(char *));
+            }
+            size_t pathLength = strlen(source) + length + 2;
+            (*images)[count] = malloc(pathLength);
+            snprintf((*images)[count++], pathLength, "%s/%s", source, entry->d_name);
+        }
+        closedir(directory);
+        qsort(*images, count, sizeof(char *), compareStrings);
+        return count;
+    }
+
+    FILE *manifest = fopen(source, "r");
+    if (manifest == NULL)
+    {
+        return -1;
+    }
+    char line[4096];
+    while (fgets(line, sizeof(line), manifest) != NULL)
+    {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#')
+        {
+            continue;
+        }
+        if (count == capacity)
+        {
+            capacity *= 2;
+            *images = realloc(*images, capacity * sizeof(char *));
+        }
+        (*images)[count++] = strdup(line);
+    }
+    fclose(manifest);
+    return count;
+}
+
+uint32_t parseMemorySize(const char *text) // bytes, with an optional K or M suffix, 0 when it is not a size
+{
+    char *end;
+    unsigned long long size = strtoull(text, &end, 0);
+    if (*end == 'K' || *end == 'k')
+    {
+        size <<= 10;
+        end++;
+    }
+    else if (*end == 'M' || *end == 'm')
+    {
+        size <<= 20;
+        end++;
+    }
+    return (*end == '\0' && size <= UINT32_MAX) ? (uint32_t)size : 0;
+}
+
+int runBatch(const char *source, int workerCount, const char *outputDirectory, const GuestOptions *options)
+{
+    char **images;
+    int jobCount = collectBatchImages(source, &images);
+    if (jobCount < 0)
+    {
+        printf("Unable to open batch: %s\n", source);
+        return 1;
+    }
+    if (workerCount < 1)
+    {
+        workerCount = 1;
+    }
+
+    BatchRunner runner = {calloc(jobCount, sizeof(BatchJob)), jobCount, calloc(workerCount, sizeof(WorkDeque)), workerCount, *options};
+    for (int w = 0; w < workerCount; w++)
+    {
+        pthread_mutex_init(&runner.deques[w].lock, NULL);
+        runner.deques[w].jobs = malloc((jobCount / workerCount + 1) * sizeof(int));
+    }
+    for (int j = 0; j < jobCount; j++) // deal the jobs out round-robin, stealing evens out whatever imbalance is left
+    {
+        BatchJob *job = &runner.jobs[j];
+        job->imagePath = images[j];
+        const char *name = strrchr(images[j], '/') ? strrchr(images[j], '/') + 1 : images[j];
+        size_t length = (outputDirectory ? strlen(outputDirectory) + strlen(name) : strlen(images[j])) + 6;
+        job->outputPath = malloc(length);
+        if (outputDirectory)
+        {
+            snprintf(job->outputPath, length, "%s/%s.out", outputDirectory, name);
+        }
+        else
+        {
+            snprintf(job->outputPath, length, "%s.out", images[j]);
+        }
+        WorkDeque *deque = &runner.deques[j % workerCount];
+        deque->jobs[deque->bottom++] = j;
+    }
+
+    double start = secondsNow();
+    pthread_t *threads = malloc(workerCount * sizeof(pthread_t));
+    BatchWorker *workers = malloc(workerCount * sizeof(BatchWorker));
+    for (int w = 0; w < workerCount; w++)
+    {
+        workers[w] = (BatchWorker){&runner, w};
+        pthread_create(&threads[w], NULL, batchWorker, &workers[w]);
+    }
+    for (int w = 0; w < workerCount; w++)
+    {
+        pthread_join(threads[w], NULL);
+    }
+    double elapsed = secondsNow() - start;
+
+    uint64_t totalInstructions = 0;
+    int failed = 0;
+    printf("%-18s %14s %10s %10s  %s\n", "status", "instructions", "ms", "MIPS", "image");
+    for (int j = 0; j < jobCount; j++)
+    {
+        BatchJob *job = &runner.jobs[j];
+        if (job->loadError)
+        {
+            printf("%-18s %14s %10s %10s  %s\n", "load error", "-", "-", "-", job->imagePath);
+            failed++;
+            continue;
+        }
+        double mips = job->seconds > 0 ? job->instructions / job->seconds / 1e6 : 0;
+        printf("%-18s %14llu %10.3f %10.2f  %s\n", vmStatusName(job->status), (unsigned long long)job->instructions, job->seconds * 1e3, mips, job->imagePath);
+        totalInstructions += job->instructions;
+    }
+    printf("batch: %d jobs (%d failed to load) on %d threads in %.3f s, %llu instructions, %.2f MIPS aggregate, %.1f jobs/s\n",
+           jobCount, failed, workerCount, elapsed, (unsigned long long)totalInstructions,
+           elapsed > 0 ? totalInstructions / elapsed / 1e6 : 0, elapsed > 0 ? jobCount / elapsed : 0);
+
+    for (int w = 0; w < workerCount; w++)
+    {
+        pthread_mutex_destroy(&runner.deques[w].lock);
+        free(runner.deques[w].jobs);
+    }
+    for (int j = 0; j < jobCount; j++)
+    {
+        free(runner.jobs[j].imagePath);
+        free(runner.jobs[j].outputPath);
+    }
+    free(images);
+    free(runner.jobs);
+    free(runner.deques);
+    free(threads);
+    free(workers);
+    return failed ? 1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+    GuestOptions options = {VM_ENGINE_SWITCH, VM_DEFAULT_MEMORY, 1, VM_JIT_DEFAULT_THRESHOLD, VM_DEFAULT_OUTPUT_BUFFER,
+                            VM_FLUSH_INPUT | VM_FLUSH_HALT | (isatty(STDOUT_FILENO) ? VM_FLUSH_NEWLINE : 0), 0, NULL};
+    TraceLevel traceLevel = TRACE_OFF;
+    uint32_t traceCapacity = 1 << 16;
+    const char *traceFile = "trace.bin";
+    int heapStats = 0;
+    const char *profileFile = NULL;
+    int fusionStats = 0;
+    int jitStats = 0;
+    const char *inputFile = NULL;
+    int nonBlockingInput = 0;
+    const char *snapshotFile = NULL;
+    uint64_t snapshotAt = 0; // instruction count to snapshot at, 0 waits for the guest to write the snapshot device
+    int resume = 0;
+    int batchWorkers = 0;
+    const char *batchOutput = NULL;
+    const char *batchSource = NULL;
+    int optionEnd = argc - 1; // the last argument is the input file, unless this is a batch
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--batch") == 0)
         {
-        case 0b000: // lb
+            optionEnd = argc;
+        }
+    }
+    int argIndex = 1;
+    for (; argIndex < optionEnd && strncmp(argv[argIndex], "--", 2) == 0; argIndex++)
+    {
+        if (strcmp(argv[argIndex], "--engine") == 0 && argIndex + 1 < optionEnd) // --engine switch|threaded|jit|aot
         {
-            if (debugga)
-            {
-                printf("lb, pc = %d\n", pc);
-            }
-            if (instr.rd == 0)
+            argIndex++;
+            if (strcmp(argv[argIndex], "threaded") == 0)
             {
-                pc += 4;
-                return;
+                options.engine = VM_ENGINE_THREADED;
             }
-            if ((regs[instr.rs1] + instr.immI) == 2066 || (regs[instr.rs1] + instr.immI) == 2070)
+            else if (strcmp(argv[argIndex], "jit") == 0)
             {
-                regs[instr.rd] = virtualReadCheck(regs[instr.rs1] + instr.immI);
-                pc += 4;
-                return;
+                options.engine = VM_ENGINE_JIT;
             }
-            if ((regs[instr.rs1] + instr.immI) < 46848 || (regs[instr.rs1] + instr.immI) > 55040)
+            else if (strcmp(argv[argIndex], "aot") == 0)
             {
-                illegalOperation(rawInstruction);
+                options.engine = VM_ENGINE_AOT;
             }
-            struct Node *current = head;
-            for (int i = 0; i < NUM_BANKS; i++)
+            else if (strcmp(argv[argIndex], "switch") != 0)
             {
-                if (current->next->startingAddress > (regs[instr.rs1] + instr.immI))
-                {
-                    regs[instr.rd] = (int)current->heap[(regs[instr.rs1] + instr.immI) - current->startingAddress]; // cast to int to ensure C sign extends the byte
-                }
-                current = current->next;
+                printf("Unknown engine: %s\n", argv[argIndex]);
+                exit(1);
             }
-            pc += 4;
-            return;
         }
-        case 0b001: // lh
+#if TRACE_SUPPORT
+        else if (strcmp(argv[argIndex], "--trace") == 0 && argIndex + 1 < optionEnd) // --trace off|records|text
         {
-            if (debugga)
-            {
-                printf("lh, pc = %d\n", pc);
-            }
-            if (instr.rd == 0)
-            {
-                pc += 4;
-                return;
-            }
-            if ((regs[instr.rs1] + instr.immI) == 2066 || (regs[instr.rs1] + instr.immI) == 2070)
+            argIndex++;
+            if (strcmp(argv[argIndex], "text") == 0)
             {
-                regs[instr.rd] = virtualReadCheck(regs[instr.rs1] + instr.immI);
-                pc += 4;
-                return;
+                traceLevel = TRACE_TEXT;
             }
-            if ((regs[instr.rs1] + instr.immI) < 46848 || (regs[instr.rs1] + instr.immI) > 55040)
+            else if (strcmp(argv[argIndex], "records") == 0)
             {
-                illegalOperation(rawInstruction);
+                traceLevel = TRACE_RECORDS;
             }
-            struct Node *current = head;
-            for (int i = 0; i < NUM_BANKS; i++)
+            else if (strcmp(argv[argIndex], "off") != 0)
             {
-                if (current->next->startingAddress > (regs[instr.rs1] + instr.immI))
-                {
-                    unsigned int firstHalf = current->heap[(regs[instr.rs1] + instr.immI) - current->startingAddress];
-                    unsigned int secondHalf = current->heap[((regs[instr.rs1] + instr.immI) - current->startingAddress) + 1];
-                    unsigned int halfWord = firstHalf | secondHalf;
-                    int castedHalfWord = (int)halfWord; // cast to int to ensure C sign extends the byte
-                    regs[instr.rd] = castedHalfWord;
-                }
-                current = current->next;
+                printf("Unknown trace level: %s\n", argv[argIndex]);
+                exit(1);
             }
-            pc += 4;
-            return;
         }
-        case 0b010: // lw
+        else if (strcmp(argv[argIndex], "--trace-file") == 0 && argIndex + 1 < optionEnd)
         {
-            if (debugga)
-            {
-                printf("lw, pc = %d\n", pc);
-            }
-            if (instr.rd == 0)
-            {
-                pc += 4;
-                return;
-            }
-            if ((regs[instr.rs1] + instr.immI) == 2066 || (regs[instr.rs1] + instr.immI) == 2070)
-            {
-                regs[instr.rd] = virtualReadCheck(regs[instr.rs1] + instr.immI);
-                pc += 4;
-                return;
-            }
-            if ((regs[instr.rs1] + instr.immI) < 46848 || (regs[instr.rs1] + instr.immI) > 55040)
-            {
-                illegalOperation(rawInstruction);
-            }
-            struct Node *current = head;
-            for (int i = 0; i < NUM_BANKS; i++)
-            {
-                if (current->next->startingAddress > (regs[instr.rs1] + instr.immI))
-                {
-                    unsigned int firstQ = current->heap[(regs[instr.rs1] + instr.immI) - current->startingAddress];
-                    unsigned int secondQ = current->heap[((regs[instr.rs1] + instr.immI) - current->startingAddress) + 1];
-                    unsigned int thirdQ = current->heap[((regs[instr.rs1] + instr.immI) - current->startingAddress) + 2];
-                    unsigned int fourthQ = current->heap[((regs[instr.rs1] + instr.immI) - current->startingAddress) + 3];
-                    regs[instr.rd] = firstQ | secondQ | thirdQ | fourthQ;
-                }
-                current = current->next;
-            }
-            pc += 4;
-            return;
+            traceFile = argv[++argIndex];
         }
-        case 0b100: // lbu
+        else if (strcmp(argv[argIndex], "--trace-buffer") == 0 && argIndex + 1 < optionEnd) // ring size in records, rounded up to a power of two
         {
-            if (debugga)
-            {
-                printf("lbu, pc = %d\n", pc);
-            }
-            if (instr.rd == 0)
-            {
-                pc += 4;
-                return;
-            }
-            if ((regs[instr.rs1] + instr.immI) == 2066 || (regs[instr.rs1] + instr.immI) == 2070)
-            {
-                regs[instr.rd] = virtualReadCheck(regs[instr.rs1] + instr.immI);
-                pc += 4;
-                return;
-            }
-            if ((regs[instr.rs1] + instr.immI) < 46848 || (regs[instr.rs1] + instr.immI) > 55040)
-            {
-                illegalOperation(rawInstruction);
-            }
-            struct Node *current = head;
-            for (int i = 0; i < NUM_BANKS; i++)
-            {
-                if (current->next->startingAddress > (regs[instr.rs1] + instr.immI))
-                {
-                    regs[instr.rd] = current->heap[(regs[instr.rs1] + instr.immI) - current->startingAddress];
-                }
-                current = current->next;
-            }
-            pc += 4;
-            return;
+            traceCapacity = strtoul(argv[++argIndex], NULL, 0);
         }
-        case 0b101: // lhu
+        else if (strcmp(argv[argIndex], "--decode-trace") == 0)
         {
-            if (debugga)
-            {
-                printf("lhu, pc = %d\n", pc);
-            }
-            if (instr.rd == 0)
-            {
-                pc += 4;
-                return;
-            }
-            if ((regs[instr.rs1] + instr.immI) == 2066 || (regs[instr.rs1] + instr.immI) == 2070)
-            {
-                regs[instr.rd] = virtualReadCheck(regs[instr.rs1] + instr.immI);
-                pc += 4;
-                return;
-            }
-            if ((regs[instr.rs1] + instr.immI) < 46848 || (regs[instr.rs1] + instr.immI) > 55040)
-            {
-                illegalOperation(rawInstruction);
-            }
-            struct Node *current = head;
-            for (int i = 0; i < NUM_BANKS; i++)
+            return vmDecodeTraceFile(argv[argIndex + 1], stdout);
+        }
+#endif
+        else if (strcmp(argv[argIndex], "--output-buffer") == 0 && argIndex + 1 < optionEnd) // console buffer in bytes, 0 writes every character straight away
+        {
+            options.outputBuffer = strtoul(argv[++argIndex], NULL, 0);
+        }
+        else if (strcmp(argv[argIndex], "--flush") == 0 && argIndex + 1 < optionEnd) // comma separated: newline,input,halt or none
+        {
+            char *policy = argv[++argIndex];
+            options.flushPolicy = 0;
+            for (char *item = strtok(policy, ","); item != NULL; item = strtok(NULL, ","))
             {
-                if (current->next->startingAddress > (regs[instr.rs1] + instr.immI))
+                if (strcmp(item, "newline") == 0)
+                {
+                    options.flushPolicy |= VM_FLUSH_NEWLINE;
+                }
+                else if (strcmp(item, "input") == 0)
+                {
+                    options.flushPolicy |= VM_FLUSH_INPUT;
+                }
+                else if (strcmp(item, "halt") == 0)
+                {
+                    options.flushPolicy |= VM_FLUSH_HALT;
+                }
+                else if (strcmp(item, "none") != 0)
                 {
-                    unsigned int firstHalf = current->heap[(regs[instr.rs1] + instr.immI) - current->startingAddress];
-                    unsigned int secondHalf = current->heap[((regs[instr.rs1] + instr.immI) - current->startingAddress) + 1];
-                    unsigned int shiftedFirstHalf = firstHalf << 8;
-                    regs[instr.rd] = shiftedFirstHalf | secondHalf;
+                    printf("Unknown flush policy: %s\n", item);
+                    exit(1);
                 }
-                current = current->next;
             }
-            pc += 4;
-            return;
         }
-        default:
-            notImplemented(rawInstruction);
-            exit(1);
+        else if (strcmp(argv[argIndex], "--input") == 0 && argIndex + 1 < optionEnd) // console input from a file or pipe instead of stdin
+        {
+            inputFile = argv[++argIndex];
         }
-    case 0b1100111: // Type I (jalr)
-        if (debugga)
+        else if (strcmp(argv[argIndex], "--nonblocking-input") == 0)
         {
-            printf("jalr, pc = %d\n", pc);
+            nonBlockingInput = 1;
         }
-        if ((regs[instr.rs1] + instr.immI) < 0 || (regs[instr.rs1] + instr.immI) > 1020)
+        else if (strcmp(argv[argIndex], "--snapshot") == 0 && argIndex + 1 < optionEnd) // write a snapshot here and stop instead of running to the end
         {
-            illegalOperation(rawInstruction);
+            snapshotFile = argv[++argIndex];
         }
-        if (instr.rd != 0)
+        else if (strcmp(argv[argIndex], "--snapshot-at") == 0 && argIndex + 1 < optionEnd)
         {
-            regs[instr.rd] = pc + 4;
+            snapshotAt = strtoull(argv[++argIndex], NULL, 0);
         }
-        pc = regs[instr.rs1] + instr.immI;
-        return;
-    case 0b0100011: // Type: S (sb, sh, sw)
-        switch (instr.func3)
+        else if (strcmp(argv[argIndex], "--resume") == 0) // the input file is a snapshot rather than an image
         {
-        case 0b000: // sb
+            resume = 1;
+        }
+        else if (strcmp(argv[argIndex], "--jobs") == 0 && argIndex + 1 < optionEnd) // worker threads for --batch, defaults to one per core
         {
-            if (debugga)
-            {
-                printf("sb, pc = %d\n", pc);
-            }
-            struct Node *current = head;
-            for (int i = 0; i < NUM_BANKS; i++)
-            {
-                if (current->next->startingAddress > (regs[instr.rs1] + instr.immS))
-                {
-                    if (virtualWriteCheck((regs[instr.rs1] + instr.immS), regs[instr.rs2]))
-                    {
-                        pc += 4;
-                        return;
-                    }
-                    current->heap[(regs[instr.rs1] + instr.immS) - current->startingAddress] = regs[instr.rs2];
-                }
-                current = current->next;
-            }
-            pc += 4;
-            return;
+            batchWorkers = atoi(argv[++argIndex]);
         }
-        case 0b001: // sh
+        else if (strcmp(argv[argIndex], "--output-dir") == 0 && argIndex + 1 < optionEnd)
         {
-            if (debugga)
-            {
-                printf("sh, pc = %d\n", pc);
-            }
-            struct Node *current = head;
-            for (int i = 0; i < NUM_BANKS; i++)
-            {
-                if (current->next->startingAddress > (regs[instr.rs1] + instr.immS))
-                {
-                    if (virtualWriteCheck((regs[instr.rs1] + instr.immS), regs[instr.rs2]))
-                    {
-                        pc += 4;
-                        return;
-                    }
-                    unsigned int firstHalf = regs[instr.rs2] & 0b11111111;
-                    unsigned int secondHalf = (regs[instr.rs2] >> 8) & 0b11111111;
-                    current->heap[(regs[instr.rs1] + instr.immS) - current->startingAddress] = firstHalf;
-                    current->heap[(regs[instr.rs1] + instr.immS) - current->startingAddress + 1] = secondHalf;
-                }
-                current = current->next;
-            }
-            pc += 4;
-            return;
+            batchOutput = argv[++argIndex];
         }
-        case 0b010: // sw
+        else if (strcmp(argv[argIndex], "--batch") == 0 && argIndex + 1 < optionEnd) // --batch <manifest or directory of .mi images>
         {
-            if (debugga)
-            {
-                printf("sw, pc = %d\n", pc);
-            }
-            struct Node *current = head;
-            for (int i = 0; i < NUM_BANKS; i++)
-            {
-                if (current->next->startingAddress > (regs[instr.rs1] + instr.immS))
-                {
-                    if (virtualWriteCheck((regs[instr.rs1] + instr.immS), regs[instr.rs2]))
-                    {
-                        pc += 4;
-                        return;
-                    }
-                    unsigned int firstQ = regs[instr.rs2] & 0b11111111;
-                    unsigned int secondQ = (regs[instr.rs2] >> 8) & 0b11111111;
-                    unsigned int thirdQ = (regs[instr.rs2] >> 16) & 0b11111111;
-                    unsigned int fourthQ = (regs[instr.rs2] >> 24) & 0b11111111;
-                    current->heap[(regs[instr.rs1] + instr.immS) - current->startingAddress] = firstQ;
-                    current->heap[(regs[instr.rs1] + instr.immS) - current->startingAddress + 1] = secondQ;
-                    current->heap[(regs[instr.rs1] + instr.immS) - current->startingAddress + 2] = thirdQ;
-                    current->heap[(regs[instr.rs1] + instr.immS) - current->startingAddress + 3] = fourthQ;
-                }
-                current = current->next;
-            }
-            pc += 4;
-            return;
+            batchSource = argv[++argIndex]; // run once every option, before or after it, is known
         }
-        default:
-            notImplemented(rawInstruction);
-            exit(1);
+        else if (strcmp(argv[argIndex], "--no-fusion") == 0) // threaded engine without superinstructions
+        {
+            options.fusion = 0;
         }
-    case 0b1100011: // Type: SB (beq, bne, blt, bltu, bge, bgeu)
-        switch (instr.func3)
+        else if (strcmp(argv[argIndex], "--fusion-stats") == 0)
         {
-        case 0b000: // beq
-            if (debugga)
-            {
-                printf("beq, pc = %d\n", pc);
-            }
-            if (regs[instr.rs1] == regs[instr.rs2])
-            {
-                if ((pc + (instr.immSB << 1)) < 0 || (pc + (instr.immSB)) > 1020)
-                {
-                    illegalOperation(rawInstruction);
-                }
-                pc = pc + (instr.immSB);
-                return;
-            }
-            pc += 4;
-            return;
-        case 0b001: // bne
-            if (debugga)
-            {
-                printf("bne, pc = %d\n", pc);
-            }
-            if (regs[instr.rs1] != regs[instr.rs2])
-            {
-                if ((pc + (instr.immSB)) < 0 || (pc + (instr.immSB)) > 1020)
-                {
-                    illegalOperation(rawInstruction);
-                }
-                pc = pc + (instr.immSB);
-                return;
-            }
-            pc += 4;
-            return;
-        case 0b100: // blt
+            fusionStats = 1;
+        }
+        else if (strcmp(argv[argIndex], "--jit-threshold") == 0 && argIndex + 1 < optionEnd) // block entries before a block is compiled
         {
-            if (debugga)
-            {
-                printf("blt, pc = %d\n", pc);
-            }
-            int signedRs1 = (int)regs[instr.rs1];
-            int signedRs2 = (int)regs[instr.rs2];
-            if (signedRs1 < signedRs2)
-            {
-                if ((pc + (instr.immSB)) < 0 || (pc + (instr.immSB)) > 1020)
-                {
-                    illegalOperation(rawInstruction);
-                }
-                pc = pc + (instr.immSB);
-                return;
-            }
-            pc += 4;
-            return;
+            options.jitThreshold = strtoul(argv[++argIndex], NULL, 0);
+        }
+        else if (strcmp(argv[argIndex], "--jit-stats") == 0)
+        {
+            jitStats = 1;
+        }
+        else if (strcmp(argv[argIndex], "--aot-cache") == 0 && argIndex + 1 < optionEnd) // where translated images are kept, batch workers included
+        {
+            options.aotCache = argv[++argIndex];
         }
-        case 0b110: // bltu
-            if (debugga)
+        else if (strcmp(argv[argIndex], "--profile") == 0 && argIndex + 1 < optionEnd) // report at path and path.json, batches write <output>.profile
+        {
+            profileFile = argv[++argIndex];
+        }
+        else if (strcmp(argv[argIndex], "--heap-stats") == 0) // report allocator statistics on stderr when the guest stops
+        {
+            heapStats = 1;
+        }
+        else if (strcmp(argv[argIndex], "--memory") == 0 && argIndex + 1 < optionEnd) // instruction,data,heap sizes in bytes, K and M suffixes
+        {
+            char *sizes = argv[++argIndex];
+            uint32_t *fields[] = {&options.memory.instructionSize, &options.memory.dataSize, &options.memory.heapSize};
+            int count = 0;
+            for (char *item = strtok(sizes, ","); item != NULL && count < 3; item = strtok(NULL, ","))
             {
-                printf("bltu, pc = %d\n", pc);
+                *fields[count++] = parseMemorySize(item);
             }
-            if (regs[instr.rs1] < regs[instr.rs2])
+            if (count != 3 || !validRegion(options.memory.instructionSize) || !validRegion(options.memory.dataSize) || !validRegion(options.memory.heapSize))
             {
-                if ((pc + (instr.immSB)) < 0 || (pc + (instr.immSB)) > 1020)
-                {
-                    illegalOperation(rawInstruction);
-                }
-                pc = pc + (instr.immSB);
-                return;
+                printf("Bad memory layout: sizes are multiples of %d bytes up to %uM\n", PAGE_SIZE, VM_MAX_MEMORY_REGION >> 20);
+                exit(1);
             }
-            pc += 4;
-            return;
-        case 0b101: // bge
+        }
+        else if (strcmp(argv[argIndex], "--huge-pages") == 0 && argIndex + 1 < optionEnd) // advise (transparent huge pages), hugetlb or off
         {
-            if (debugga)
+            argIndex++;
+            if (strcmp(argv[argIndex], "advise") == 0)
             {
-                printf("bge, pc = %d\n", pc);
+                options.memory.flags = VM_MEMORY_HUGE_PAGES;
             }
-            int signedRs1 = (int)regs[instr.rs1];
-            int signedRs2 = (int)regs[instr.rs2];
-            if (signedRs1 >= signedRs2)
+            else if (strcmp(argv[argIndex], "hugetlb") == 0)
             {
-                if ((pc + (instr.immSB)) < 0 || (pc + (instr.immSB)) > 1020)
-                {
-                    illegalOperation(rawInstruction);
-                }
-                pc = pc + (instr.immSB);
-                return;
+                options.memory.flags = VM_MEMORY_HUGETLB | VM_MEMORY_HUGE_PAGES; // transparent huge pages when the pool is empty
             }
-            pc += 4;
-            return;
-        }
-        case 0b111: // bgeu
-            if (debugga)
+            else if (strcmp(argv[argIndex], "off") == 0)
             {
-                printf("bgeu, pc = %d\n", pc);
+                options.memory.flags = 0;
             }
-            if (regs[instr.rs1] >= regs[instr.rs2])
+            else
             {
-                if ((pc + (instr.immSB)) < 0 || (pc + (instr.immSB)) > 1020)
-                {
-                    illegalOperation(rawInstruction);
-                }
-                pc = pc + (instr.immSB);
-                return;
+                printf("Unknown huge page mode: %s\n", argv[argIndex]);
+                exit(1);
             }
-            pc += 4;
-            return;
-        default:
-            notImplemented(rawInstruction);
-            exit(1);
-        }
-    case 0b0110111: // Type: U (lui)
-    {
-        if (debugga)
-        {
-            printf("lui, pc = %d\n", pc);
         }
-        if (instr.rd == 0)
+        else
         {
-            pc += 4;
-            return;
+            printf("Unknown option: %s\n", argv[argIndex]);
+            exit(1);
         }
-        regs[instr.rd] = instr.immU;
-        pc += 4;
-        return;
     }
-    case 0b1101111: // Type: UJ (jal)
-        if (debugga)
-        {
-            printf("jal, pc = %d\n", pc);
-        }
-        if ((pc + (instr.immUJ)) < 0 || (pc + (instr.immUJ)) > 1020)
-        {
-            illegalOperation(rawInstruction);
-        }
-        if (instr.rd != 0)
+
+    options.profile = profileFile != NULL;
+    if (batchSource != NULL && argIndex == argc)
+    {
+        if (batchWorkers == 0)
         {
-            regs[instr.rd] = pc + 4;
+            long cores = sysconf(_SC_NPROCESSORS_ONLN);
+            batchWorkers = cores > 0 ? cores : 1;
         }
-        pc = pc + (instr.immUJ);
-        return;
-    default:
-        notImplemented(rawInstruction);
+        return runBatch(batchSource, batchWorkers, batchOutput, &options);
+    }
+    if (batchSource != NULL || argc <= argIndex)
+    {
+        printf("Usage: %s [--engine switch|threaded|jit|aot] [--output-buffer bytes] [--flush newline,input,halt|none]\n"
+               "          [--input file] [--nonblocking-input] [--snapshot path [--snapshot-at instructions]] [--resume]\n"
+               "          [--trace off|records|text] [--trace-file path] [--trace-buffer records] [--no-fusion] [--fusion-stats]\n"
+               "          [--jit-threshold entries] [--jit-stats] [--aot-cache dir] [--profile path] [--heap-stats]\n"
+               "          [--memory instruction,data,heap] [--huge-pages advise|hugetlb|off] <input file>\n", argv[0]);
+        printf("       %s --batch <manifest or directory> [--jobs threads] [--output-dir dir] [--profile on]\n"
+               "          [--engine, --memory, --huge-pages, --output-buffer, --flush, --no-fusion, --jit-threshold, --aot-cache as above]\n", argv[0]);
+        printf("       %s --decode-trace <trace file>\n", argv[0]);
+        printf("       --profile runs a counting interpreter in place of --engine, expect switch engine speed at best\n");
         exit(1);
     }
-    // pc += 4;
-}
-
-int main(int argc, char *argv[])
-{
-    struct Node *current = NULL;
 
-    for (int i = 0; i < NUM_BANKS; i++) // create the Heap Bank linked list
+    VM *vm = vmCreate();
+    if (vm == NULL || configureGuest(vm, &options) != 0 || vmSetTrace(vm, traceLevel, traceCapacity) != 0)
     {
-        struct Node *newNode = malloc(sizeof(struct Node));
-        if (newNode == NULL)
-        {
-            printf("Error: unable to allocate memory.\n");
-            return 1;
-        }
-
-        for (int j = 0; j < HEAP_SIZE; j++) // initialise the bank arrays to 0
-        {
-            newNode->heap[j] = 0;
-        }
-
-        newNode->next = NULL; // set the next pointer for the next node, the heap address, and unallocated.
-        newNode->startingAddress = (46848 + (i * 64));
-        newNode->allocated = 0;
-
-        if (head == NULL) // add the node to the linked list
-        {
-            head = newNode;
-            current = newNode;
-        }
-        else
-        {
-            current->next = newNode;
-            current = newNode;
-        }
+        printf("Error: unable to allocate memory.\n");
+        return 1;
     }
 
-    if (argc < 2)
+    int loaded = resume ? vmLoadSnapshot(vm, argv[argIndex]) : vmLoadFile(vm, argv[argIndex]);
+    if (loaded == -1)
     {
-        printf("Usage: %s <input file>\n", argv[0]);
+        printf("Unable to open input file: %s\n", argv[argIndex]);
         exit(1);
     }
-
-    FILE *input = fopen(argv[1], "rb");
-    if (input == NULL)
+    if (loaded != 0 && resume)
     {
-        printf("Unable to open input file: %s\n", argv[1]);
+        printf("Not a valid snapshot: %s\n", argv[argIndex]);
         exit(1);
     }
-
-    MachineInstructions inputData;
-
-    size_t misRead = fread(&inputData, sizeof(MachineInstructions), 1, input);
-    if (misRead != 1)
+    if (loaded != 0)
     {
         perror("Error reading from file");
-        fclose(input);
         exit(1);
     }
 
-    fclose(input);
-    while (pc < 1024) // iterate over the instructions in steps of 4 bytes
+    if (options.engine == VM_ENGINE_AOT && vmAotPrepare(vm) != 0)
     {
-        Immediate unsignedImm;
-        // int mostSig;
-        Instruction instr;
-        // extract raw instruction
-        unsigned int rawInstruction = (inputData.inst_mem[pc] | (inputData.inst_mem[pc + 1] << 8) | (inputData.inst_mem[pc + 2] << 16) | (inputData.inst_mem[pc + 3] << 24));
-
-        // decode opcode
-        unsigned int opcodeByte = inputData.inst_mem[pc];
-
-        instr.opcode = (opcodeByte & 0b1111111);
-
-        // decode rd
-        unsigned int rdByte1 = inputData.inst_mem[pc];
-
-        unsigned int rdByte2 = inputData.inst_mem[pc + 1];
-        unsigned int isolatedRdByte2 = (rdByte2 & 0b1111) << 1;
-
-        instr.rd = isolatedRdByte2 | (rdByte1 >> 7);
-
-        // decode func3
-        unsigned int func3Byte = inputData.inst_mem[pc + 1];
-
-        instr.func3 = (func3Byte & 0b1110000) >> 4;
-
-        // decode rs1
-        unsigned int rs1Byte1 = inputData.inst_mem[pc + 1];
-
-        unsigned int rs1Byte2 = inputData.inst_mem[pc + 2];
-        unsigned int isolatedRs1Byte2 = (rs1Byte2 & 0b1111) << 1;
-
-        instr.rs1 = isolatedRs1Byte2 | (rs1Byte1 >> 7);
-
-        // decode rs2
-        unsigned int rs2Byte1 = inputData.inst_mem[pc + 2];
-        unsigned int isolatedRs2Byte1 = rs2Byte1 >> 4;
-
-        unsigned int rs2Byte2 = inputData.inst_mem[pc + 3];
-        unsigned int isolatedRs2Byte2 = (rs2Byte2 & 0b1) << 4;
-
-        instr.rs2 = isolatedRs2Byte1 | isolatedRs2Byte2;
-
-        // decode func7
-        unsigned int func7Byte = inputData.inst_mem[pc + 3];
-
-        instr.func7 = func7Byte >> 1;
-
-        // decode imm Type I
-        unsigned int immIByte1 = inputData.inst_mem[pc + 2];
-        unsigned int isolatedImmIByte1 = immIByte1 >> 4;
-
-        unsigned int immIByte2 = inputData.inst_mem[pc + 3];
-        unsigned int shiftedImmIByte2 = immIByte2 << 4;
-
-        unsignedImm.u = isolatedImmIByte1 | shiftedImmIByte2;
-        if (unsignedImm.u & 0x800)
-        {
-            unsignedImm.u |= 0xFFFFF000;
-        }
-        instr.immI = unsignedImm.s;
-
-        // decode imm Type S
-        unsigned int immSByte1 = inputData.inst_mem[pc];
-
-        unsigned int immSByte2 = inputData.inst_mem[pc + 1];
-        unsigned int isolatedImmSByte2 = (immSByte2 & 0b1111) << 1;
-        unsigned int immSLower = isolatedImmSByte2 | (immSByte1 >> 7);
+        fprintf(stderr, "AOT translation unavailable, interpreting instead\n");
+    }
 
-        unsigned int immSByte3 = inputData.inst_mem[pc + 3];
-        unsigned int shiftedImmSByte3 = immSByte3 >> 1;
-        unsigned int immSUpper = shiftedImmSByte3 << 5;
+    FILE *input = stdin;
+    if (inputFile != NULL && (input = fopen(inputFile, "r")) == NULL)
+    {
+        printf("Unable to open console input: %s\n", inputFile);
+        exit(1);
+    }
+    vmSetConsole(vm, input, stdout);
+    vmSetInputNonBlocking(vm, nonBlockingInput);
 
-        unsignedImm.u = immSLower | immSUpper;
-        if (unsignedImm.u & 0x800)
+    vmSetSnapshotTrigger(vm, snapshotFile != NULL && snapshotAt == 0);
+    VMStatus status;
+    for (;;)
+    {
+        uint64_t budget = VM_RUN_FOREVER;
+        if (snapshotFile != NULL && snapshotAt != 0)
         {
-            unsignedImm.u |= 0xFFFFF000;
+            budget = snapshotAt > vmInstructionsExecuted(vm) ? snapshotAt - vmInstructionsExecuted(vm) : 0;
         }
-        instr.immS = unsignedImm.s;
-
-        // decode imm Type SB
-        unsigned int immSBByte1 = inputData.inst_mem[pc];
-        unsigned int isolatedImmSBByte1 = immSBByte1 >> 7;
-        unsigned int shiftedImmSBByte1 = isolatedImmSBByte1 << 11;
-
-        unsigned int immSBByte2 = inputData.inst_mem[pc + 1];
-        unsigned int isolatedImmSBByte2 = immSBByte2 & 0b1111;
-        unsigned int shiftedImmSBByte2 = isolatedImmSBByte2 << 1;
-
-        unsigned int immSBByte3 = inputData.inst_mem[pc + 3];
-        unsigned int isolatedImmSBByte3 = immSBByte3 & 0b1111110;
-        unsigned int shiftedImmSBByte3 = isolatedImmSBByte3 << 4;
-
-        unsigned int lastImmSBBit = immSBByte3 >> 7;
-        unsigned int shiftedImmSBBit = lastImmSBBit << 12;
-
-        unsignedImm.u = shiftedImmSBByte1 | shiftedImmSBByte2 | shiftedImmSBByte3 | shiftedImmSBBit;
-        if (unsignedImm.u & 0x1000)
+        status = vmRun(vm, budget);
+        if (status != VM_WAITING_INPUT)
         {
-            unsignedImm.u |= 0xFFFFE000;
+            break;
         }
-        instr.immSB = unsignedImm.s; // good
-
-        // decode imm Type U
-        unsigned int immUByte1 = inputData.inst_mem[pc + 1];
-        unsigned int isolatedImmUByte1 = immUByte1 >> 4;
-        unsigned int shiftedImmUByte1 = isolatedImmUByte1 << 12;
-
-        unsigned int immUByte2 = inputData.inst_mem[pc + 2];
-        unsigned int shiftedImmUByte2 = immUByte2 << 16;
-
-        unsigned int immUByte3 = inputData.inst_mem[pc + 3];
-        unsigned int shiftedImmUByte3 = immUByte3 << 24;
-
-        // unsignedImm.u = shiftedImmUByte1 | shiftedImmUByte2 | shiftedImmUByte3;
-        // u = *(int32_t*)&unsignedImm.u;
-        // instr.immU = u;
-        unsignedImm.u = shiftedImmUByte1 | shiftedImmUByte2 | shiftedImmUByte3;
-        instr.immU = unsignedImm.s;
-
-        // decode imm Type UJ
-        unsigned int immUJByte1 = inputData.inst_mem[pc + 1];
-        unsigned int isolatedImmUJ15_12 = immUJByte1 >> 4;
-        unsigned int shiftedImmUJ15_12 = isolatedImmUJ15_12 << 11;
-
-        unsigned int immUJByte2 = inputData.inst_mem[pc + 2];
-        unsigned int isolatedImmUJ19_16 = immUJByte2 & 0b1111;
-        unsigned int shiftedImmUJ19_16 = isolatedImmUJ19_16 << 15;
-        unsigned int isolatedImmUJ11 = immUJByte2 & 0b00010000;
-        unsigned int shiftedImmUJ11 = isolatedImmUJ11 << 7;
-        unsigned int isolatedImmUJ3_1 = immUJByte2 >> 5;
-        unsigned int shiftedImmUJ3_1 = isolatedImmUJ3_1 << 1;
-
-        unsigned int immUJByte3 = inputData.inst_mem[pc + 3];
-        unsigned int isolatedImmUJ20 = immUJByte3 >> 7;
-        unsigned int shiftedImmUJ20 = isolatedImmUJ20 << 20;
-        unsigned int isolatedImmUJ10_4 = immUJByte3 & 0b1111111;
-        unsigned int shiftedImmUJ10_4 = isolatedImmUJ10_4 << 4;
-
-        unsignedImm.u = shiftedImmUJ20 | shiftedImmUJ19_16 | shiftedImmUJ15_12 | shiftedImmUJ11 | shiftedImmUJ10_4 | shiftedImmUJ3_1;
-        if (unsignedImm.u & 0x100000)
+        struct pollfd ready = {vmInputFd(vm), POLLIN, 0}; // a lone guest has nothing else to do, so wait for its input here
+        poll(&ready, 1, -1);
+    }
+    if (snapshotFile != NULL && (status == VM_SNAPSHOT_POINT || status == VM_RUNNING))
+    {
+        if (vmSaveSnapshot(vm, snapshotFile) != 0)
         {
-            unsignedImm.u |= 0xFFE00000;
+            perror("Unable to write snapshot");
+            return 1;
         }
-        instr.immUJ = unsignedImm.s;
+        fprintf(stderr, "snapshot after %llu instructions written to %s\n", (unsigned long long)vmInstructionsExecuted(vm), snapshotFile);
+        vmDestroy(vm);
+        return 0;
+    }
+    if (input != stdin)
+    {
+        fclose(input);
+    }
 
-        execute(instr, rawInstruction); // send it to execute
+    if (traceLevel == TRACE_RECORDS && vmWriteTrace(vm, traceFile) != 0)
+    {
+        perror("Unable to write trace file");
+    }
+    if (profileFile != NULL && writeProfileFiles(vm, profileFile) != 0)
+    {
+        perror("Unable to write profile");
+    }
+    if (fusionStats)
+    {
+        vmPrintFusionStatistics(vm, stderr);
+    }
+    if (jitStats)
+    {
+        vmPrintJitStatistics(vm, stderr);
+    }
+    if (heapStats)
+    {
+        vmPrintHeapStatistics(vm, stderr);
     }
+    vmDestroy(vm);
 
-    return 0;
+    return (status == VM_HALTED) ? 1 : 0; // HALT has always left with status 1
 }
+#endif
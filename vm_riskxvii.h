@@ -0,0 +1,184 @@
+#ifndef VM_RISKXVII_H
+#define VM_RISKXVII_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define VM_IMAGE_SIZE 2048            // instruction memory followed by data memory, the size of a .mi file with the default memory
+#define VM_RUN_FOREVER UINT64_MAX     // instruction budget for vmRun that never runs out
+
+typedef struct VM VM; // one guest machine, every piece of its state lives in here
+
+typedef enum
+{
+    VM_RUNNING,           // the instruction budget ran out, vmRun can be called again to continue
+    VM_HALTED,            // the guest wrote to the HALT device
+    VM_ILLEGAL_OPERATION, // bad memory access or jump target, registers were dumped to the output
+    VM_NOT_IMPLEMENTED,   // the guest reached an instruction the VM does not know
+    VM_END_OF_PROGRAM,    // pc ran off the end of instruction memory
+    VM_WAITING_INPUT,     // parked on a console read with no input available yet (non-blocking input only)
+    VM_SNAPSHOT_POINT     // the guest wrote VM_SNAPSHOT_DEVICE with the snapshot trigger on, vmRun continues past it
+} VMStatus;
+
+typedef enum
+{
+    VM_ENGINE_SWITCH,
+    VM_ENGINE_THREADED, // direct-threaded dispatch, the switch engine where computed goto is unavailable
+    VM_ENGINE_JIT,      // interpreter that compiles hot blocks to x86-64, the threaded engine on other hosts
+    VM_ENGINE_AOT       // the whole image translated to C and loaded as a cached shared object, threaded engine if that fails
+} VMEngine;
+
+#define VM_JIT_DEFAULT_THRESHOLD 50 // block entries before the JIT compiles a block
+
+#define VM_DEFAULT_OUTPUT_BUFFER 4096
+#define VM_INPUT_BUFFER 65536 // console input is read ahead in chunks of up to this many bytes
+
+typedef enum // when buffered console output is written out, on top of whenever the buffer fills up
+{
+    VM_FLUSH_NEWLINE = 1, // after every write containing '\n', for interactive terminals
+    VM_FLUSH_INPUT = 2,   // before the guest reads the console, so prompts appear before the read
+    VM_FLUSH_HALT = 4     // when vmRun returns because the guest stopped
+} VMFlushPolicy;
+
+typedef enum
+{
+    TRACE_OFF,     // untraced engines, nothing is recorded
+    TRACE_RECORDS, // binary TraceRecords into the ring buffer, written out by vmWriteTrace
+    TRACE_TEXT     // one "op, pc = N" line per instruction on the output stream
+} TraceLevel;
+
+typedef struct
+{
+    unsigned int usedBanks;
+    unsigned int freeBanks;
+    unsigned int largestFreeRun; // longest run of adjacent free banks, the biggest malloc that can still succeed
+    unsigned int peakUsedBanks;  // high-water mark of usedBanks
+    unsigned int liveAllocations;
+    unsigned int totalAllocations;
+    unsigned int failedAllocations;
+} HeapStats;
+
+typedef struct
+{
+    unsigned int sites;        // superinstructions found in the loaded image
+    unsigned int instructions; // guest instructions they cover
+    uint64_t dispatches;       // superinstructions run by the threaded engine
+    uint64_t retired;          // guest instructions retired through them
+} FusionStats;
+
+typedef struct
+{
+    unsigned int blocks;
+    size_t codeBytes;
+    uint64_t retired; // guest instructions retired in compiled code
+    uint64_t bails;   // exits at device accesses and addresses outside the heap
+} JitStats;
+
+// Guest memory: instruction memory at 0, data memory right after it and the heap at 0xb700, or just past data
+// memory when that reaches further. The device page at 0x800 stays put; where instruction or data memory extends
+// over it, loads and stores there still go to the devices and instruction fetch still reads instruction memory.
+// All three regions live in one mmap reservation.
+typedef enum
+{
+    VM_MEMORY_HUGE_PAGES = 1, // madvise(MADV_HUGEPAGE), transparent huge pages where the kernel allows them
+    VM_MEMORY_HUGETLB = 2     // MAP_HUGETLB from the reserved pool, ordinary pages when the pool is empty
+} VMMemoryFlags;
+
+typedef struct
+{
+    uint32_t instructionSize; // each size a multiple of 256 bytes and at most VM_MAX_MEMORY_REGION
+    uint32_t dataSize;
+    uint32_t heapSize; // malloc hands it out in 64-byte banks
+    unsigned int flags; // VMMemoryFlags
+} VMMemoryConfig;
+
+#define VM_DEFAULT_MEMORY ((VMMemoryConfig){1024, 1024, 8192, 0})
+#define VM_MAX_MEMORY_REGION (256u << 20)
+
+VM *vmCreate(void); // default memory, NULL when out of memory
+void vmDestroy(VM *vm);
+int vmSetMemory(VM *vm, VMMemoryConfig config); // resets the machine to an empty image, -1 when out of memory, -2 for a bad layout
+VMMemoryConfig vmMemory(const VM *vm);
+size_t vmImageSize(const VM *vm); // instruction plus data memory, what an image for this layout holds
+
+// Both loaders reset the machine (registers, pc, heap) before taking the new image.
+// They return 0 on success, -1 when the file cannot be opened and -2 when the image is shorter than vmImageSize().
+int vmLoadImage(VM *vm, const void *image, size_t size);
+int vmLoadFile(VM *vm, const char *path);
+
+void vmSetConsole(VM *vm, FILE *input, FILE *output); // defaults to stdin and stdout
+void vmSetInputNonBlocking(VM *vm, int nonBlocking);   // vmRun returns VM_WAITING_INPUT instead of blocking on a console read
+int vmInputFd(const VM *vm);                           // poll this for POLLIN before resuming a guest waiting for input
+void vmSetEngine(VM *vm, VMEngine engine);
+void vmSetFusion(VM *vm, int enabled); // superinstructions in the threaded engine, on by default
+void vmSetJitThreshold(VM *vm, unsigned int threshold);
+int vmSetAotCache(VM *vm, const char *directory); // NULL: $RISKXVII_AOT_CACHE, else ~/.cache/riskxvii
+int vmAotPrepare(VM *vm); // translate, compile or load from the cache now instead of on the first vmRun, -1 when unavailable
+                          // or when the cache directory is not private to this user
+
+// Snapshots hold pc, registers, instruction and data memory, the heap and its bank state behind a fixed-size
+// header, written as-is so that restoring from a mapped file is plain copying. Console state is not included.
+#define VM_SNAPSHOT_DEVICE 2104 // guest store here marks the snapshot point
+size_t vmSnapshotSize(const VM *vm);                               // depends on the memory layout
+int vmSaveSnapshot(VM *vm, const char *path);                      // flushes console output first, -1 on a write error
+int vmRestoreSnapshot(VM *vm, const void *snapshot, size_t size);   // from memory, switching to its memory layout, -2 when it is not a valid snapshot,
+                                                                   // -1 when its layout does not fit in memory
+int vmLoadSnapshot(VM *vm, const char *path);                      // mmaps the file and restores it, -1 when it cannot be opened
+void vmSetSnapshotTrigger(VM *vm, int enabled);                    // stop at VM_SNAPSHOT_DEVICE writes instead of ignoring them
+// Profiling runs the guest in a counting loop instead of the selected engine, a little slower than VM_ENGINE_SWITCH and
+// many times slower than the threaded, JIT and AOT engines, so it is for diagnosing a guest rather than for every run.
+int vmSetProfile(VM *vm, int enabled);                     // -1 when out of memory, counts restart whenever an image is loaded
+int vmWriteProfile(const VM *vm, FILE *output, int json);  // opcode, device and branch counts and the hottest blocks, -1 when not profiling
+int vmSetOutputBuffer(VM *vm, size_t capacity, unsigned int flushPolicy); // capacity 0 writes every character straight away
+void vmFlushOutput(VM *vm);
+int vmSetTrace(VM *vm, TraceLevel level, uint32_t capacity); // capacity in records, rounded up to a power of two
+int vmWriteTrace(const VM *vm, const char *path);
+int vmDecodeTraceFile(const char *path, FILE *output);
+
+VMStatus vmRun(VM *vm, uint64_t maxInstructions); // run until the guest stops or maxInstructions have executed
+
+VMStatus vmStatus(const VM *vm);
+int vmPc(const VM *vm);
+int vmRegister(const VM *vm, int index);
+uint64_t vmInstructionsExecuted(const VM *vm);
+const char *vmStatusName(VMStatus status);
+HeapStats vmHeapStatistics(const VM *vm);
+void vmPrintHeapStatistics(const VM *vm, FILE *output);
+FusionStats vmFusionStatistics(const VM *vm);
+void vmPrintFusionStatistics(const VM *vm, FILE *output);
+JitStats vmJitStatistics(const VM *vm);
+void vmPrintJitStatistics(const VM *vm, FILE *output);
+
+// A scheduler time-slices many guests on the calling thread, vmRun(quantum) at a time. Guests that block
+// on console input are parked until their input fd polls readable. Schedulers joined into a group steal
+// ready guests from each other when they run dry, one scheduler per host thread.
+typedef struct VMScheduler VMScheduler;
+
+typedef enum
+{
+    VM_SCHEDULE_ROUND_ROBIN, // every ready guest gets a quantum in turn
+    VM_SCHEDULE_PRIORITY     // the highest priority ready guest runs, round-robin among equals
+} VMSchedulePolicy;
+
+typedef void (*VMGuestFinished)(VM *vm, VMStatus status, void *context); // the guest has left the scheduler, the caller still owns it
+
+typedef struct
+{
+    uint64_t quanta;   // vmRun calls made
+    uint64_t parks;    // times a guest blocked on input
+    uint64_t steals;   // guests taken from other schedulers of the group
+    uint64_t finished; // guests handed to the finished callback
+} VMSchedulerStats;
+
+#define VM_DEFAULT_QUANTUM 10000 // instructions per time slice
+
+VMScheduler *vmSchedulerCreate(VMSchedulePolicy policy, uint64_t quantum); // NULL when out of memory
+void vmSchedulerDestroy(VMScheduler *scheduler);                          // guests still queued are left alone
+void vmSchedulerOnFinished(VMScheduler *scheduler, VMGuestFinished finished, void *context);
+int vmSchedulerAdd(VMScheduler *scheduler, VM *vm, int priority); // switches the guest to non-blocking input, -1 when out of memory
+void vmSchedulerGroup(VMScheduler **schedulers, int count);      // steal from each other, the array must outlive their runs
+int vmSchedulerRun(VMScheduler *scheduler); // until no guest is left here or to steal, returns how many finished
+VMSchedulerStats vmSchedulerStatistics(const VMScheduler *scheduler);
+
+#endif